@@ -0,0 +1,375 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <tscb/async-io>
+
+namespace tscb {
+
+	async_io_operation::async_io_operation(int fd, async_io_completion completion) noexcept
+		: fd_(fd), result_(-1), error_(0), pending_(true), completion_(std::move(completion))
+	{
+	}
+
+	async_io_operation::~async_io_operation(void) noexcept
+	{
+	}
+
+	void async_io_operation::disconnect(void) noexcept
+	{
+		std::unique_lock<std::mutex> guard(registration_mutex_);
+		if (!pending_) {
+			return;
+		}
+		pending_ = false;
+		async_io_completion completion;
+		completion.swap(completion_);
+		ioready_connection link(std::move(link_));
+		guard.unlock();
+
+		/* both the readiness callback and the completion function may
+		hold references to this object, so drop them outside the lock */
+		link.disconnect();
+	}
+
+	bool async_io_operation::connected(void) const noexcept
+	{
+		std::unique_lock<std::mutex> guard(registration_mutex_);
+		return pending_;
+	}
+
+	void async_io_operation::start(posix_reactor_service & reactor, ioready_events event_mask)
+	{
+		if (attempt()) {
+			/* completed without waiting; defer the completion to the
+			reactor so the caller never sees its completion function
+			called from within the submitting function */
+			reactor.post(std::bind(&async_io_operation::complete,
+				intrusive_ptr<async_io_operation>(this)));
+			return;
+		}
+
+		ioready_connection link = reactor.watch(std::bind(&async_io_operation::ready,
+			intrusive_ptr<async_io_operation>(this), std::placeholders::_1), fd_, event_mask);
+
+		std::unique_lock<std::mutex> guard(registration_mutex_);
+		if (pending_) {
+			link_ = link;
+		} else {
+			/* cancelled concurrently before link was stored */
+			guard.unlock();
+			link.disconnect();
+		}
+	}
+
+	void async_io_operation::ready(ioready_events) noexcept
+	{
+		{
+			std::unique_lock<std::mutex> guard(registration_mutex_);
+			if (!pending_) {
+				return;
+			}
+		}
+
+		if (attempt()) {
+			complete();
+		}
+	}
+
+	void async_io_operation::complete(void) noexcept
+	{
+		std::unique_lock<std::mutex> guard(registration_mutex_);
+		if (!pending_) {
+			return;
+		}
+		pending_ = false;
+		async_io_completion completion;
+		completion.swap(completion_);
+		ioready_connection link(std::move(link_));
+		guard.unlock();
+
+		link.disconnect();
+		completion(result_, error_);
+	}
+
+	namespace {
+
+	class async_read_operation : public async_io_operation {
+	public:
+		async_read_operation(int fd, void * buffer, size_t size, async_io_completion completion) noexcept
+			: async_io_operation(fd, std::move(completion)), buffer_(buffer), size_(size)
+		{
+		}
+
+	protected:
+		virtual bool attempt(void) noexcept
+		{
+			ssize_t n;
+			do {
+				n = ::read(fd_, buffer_, size_);
+			} while (n < 0 && errno == EINTR);
+
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return false;
+			}
+			result_ = n;
+			error_ = n < 0 ? errno : 0;
+			return true;
+		}
+
+		void * buffer_;
+		size_t size_;
+	};
+
+	class async_write_operation : public async_io_operation {
+	public:
+		async_write_operation(int fd, const void * buffer, size_t size, async_io_completion completion) noexcept
+			: async_io_operation(fd, std::move(completion)), buffer_(static_cast<const char *>(buffer)),
+			size_(size), written_(0)
+		{
+		}
+
+	protected:
+		virtual bool attempt(void) noexcept
+		{
+			while (written_ < size_) {
+				ssize_t n = ::write(fd_, buffer_ + written_, size_ - written_);
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						return false;
+					}
+					result_ = -1;
+					error_ = errno;
+					return true;
+				}
+				written_ += n;
+			}
+			result_ = written_;
+			error_ = 0;
+			return true;
+		}
+
+		const char * buffer_;
+		size_t size_;
+		size_t written_;
+	};
+
+	class async_sendfile_operation : public async_io_operation {
+	public:
+		async_sendfile_operation(int fd, int file, off_t offset, size_t length,
+			const struct iovec * header, size_t header_count,
+			const struct iovec * trailer, size_t trailer_count,
+			async_io_completion completion)
+			: async_io_operation(fd, std::move(completion)),
+			header_(header, header + header_count), trailer_(trailer, trailer + trailer_count),
+			file_(file), offset_(offset), remaining_(length), header_pos_(0), trailer_pos_(0), written_(0)
+		{
+		}
+
+	protected:
+		virtual bool attempt(void) noexcept
+		{
+			int error = write_iovecs(header_, header_pos_);
+			while (!error && remaining_) {
+				ssize_t n = ::sendfile(fd_, file_, &offset_, remaining_);
+				if (n < 0) {
+					error = errno == EINTR ? 0 : errno;
+				} else if (n == 0) {
+					/* file shorter than requested region */
+					error = ENODATA;
+				} else {
+					remaining_ -= n;
+					written_ += n;
+				}
+			}
+			if (!error) {
+				error = write_iovecs(trailer_, trailer_pos_);
+			}
+
+			if (error == EAGAIN || error == EWOULDBLOCK) {
+				return false;
+			}
+			result_ = error ? -1 : ssize_t(written_);
+			error_ = error;
+			return true;
+		}
+
+		/* returns 0 once all iovecs have been written, errno otherwise */
+		int write_iovecs(std::vector<struct iovec> & iov, size_t & pos) noexcept
+		{
+			while (pos < iov.size()) {
+				if (iov[pos].iov_len == 0) {
+					++pos;
+					continue;
+				}
+				ssize_t n = ::writev(fd_, &iov[pos], std::min(iov.size() - pos, size_t(IOV_MAX)));
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return errno;
+				}
+				written_ += n;
+				while (n > 0) {
+					size_t chunk = std::min(size_t(n), iov[pos].iov_len);
+					iov[pos].iov_base = static_cast<char *>(iov[pos].iov_base) + chunk;
+					iov[pos].iov_len -= chunk;
+					n -= chunk;
+					if (iov[pos].iov_len == 0) {
+						++pos;
+					}
+				}
+			}
+			return 0;
+		}
+
+		std::vector<struct iovec> header_, trailer_;
+		int file_;
+		off_t offset_;
+		size_t remaining_;
+		size_t header_pos_, trailer_pos_;
+		size_t written_;
+	};
+
+	class async_accept_operation : public async_io_operation {
+	public:
+		async_accept_operation(int fd, async_io_completion completion) noexcept
+			: async_io_operation(fd, std::move(completion))
+		{
+		}
+
+	protected:
+		virtual bool attempt(void) noexcept
+		{
+			int s;
+			do {
+				s = ::accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			} while (s < 0 && (errno == EINTR || errno == ECONNABORTED));
+
+			if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return false;
+			}
+			result_ = s;
+			error_ = s < 0 ? errno : 0;
+			return true;
+		}
+	};
+
+	class async_connect_operation : public async_io_operation {
+	public:
+		async_connect_operation(int fd, const struct sockaddr * address, socklen_t address_len,
+			async_io_completion completion) noexcept
+			: async_io_operation(fd, std::move(completion)), address_len_(address_len), in_progress_(false)
+		{
+			if (address_len_ > sizeof(address_)) {
+				address_len_ = sizeof(address_);
+			}
+			memcpy(&address_, address, address_len_);
+		}
+
+	protected:
+		virtual bool attempt(void) noexcept
+		{
+			if (in_progress_) {
+				int error = 0;
+				socklen_t len = sizeof(error);
+				if (::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+					error = errno;
+				}
+				result_ = error ? -1 : 0;
+				error_ = error;
+				return true;
+			}
+
+			if (::connect(fd_, reinterpret_cast<const struct sockaddr *>(&address_), address_len_) == 0) {
+				result_ = 0;
+				error_ = 0;
+				return true;
+			}
+			if (errno == EINPROGRESS || errno == EINTR) {
+				in_progress_ = true;
+				return false;
+			}
+			result_ = -1;
+			error_ = errno;
+			return true;
+		}
+
+		struct sockaddr_storage address_;
+		socklen_t address_len_;
+		bool in_progress_;
+	};
+
+	}
+
+	connection
+	async_read(posix_reactor_service & reactor, int fd, void * buffer, size_t size,
+		async_io_completion completion)
+	{
+		async_io_operation * op = new async_read_operation(fd, buffer, size, std::move(completion));
+		connection conn(op, false);
+		op->start(reactor, ioready_input);
+		return conn;
+	}
+
+	connection
+	async_write(posix_reactor_service & reactor, int fd, const void * buffer, size_t size,
+		async_io_completion completion)
+	{
+		async_io_operation * op = new async_write_operation(fd, buffer, size, std::move(completion));
+		connection conn(op, false);
+		op->start(reactor, ioready_output);
+		return conn;
+	}
+
+	connection
+	async_sendfile(posix_reactor_service & reactor, int fd, int file, off_t offset, size_t length,
+		const struct iovec * header, size_t header_count,
+		const struct iovec * trailer, size_t trailer_count,
+		async_io_completion completion)
+	{
+		async_io_operation * op = new async_sendfile_operation(fd, file, offset, length,
+			header, header_count, trailer, trailer_count, std::move(completion));
+		connection conn(op, false);
+		op->start(reactor, ioready_output);
+		return conn;
+	}
+
+	connection
+	async_accept(posix_reactor_service & reactor, int fd,
+		async_io_completion completion)
+	{
+		async_io_operation * op = new async_accept_operation(fd, std::move(completion));
+		connection conn(op, false);
+		op->start(reactor, ioready_input);
+		return conn;
+	}
+
+	connection
+	async_connect(posix_reactor_service & reactor, int fd,
+		const struct sockaddr * address, socklen_t address_len,
+		async_io_completion completion)
+	{
+		async_io_operation * op = new async_connect_operation(fd, address, address_len, std::move(completion));
+		connection conn(op, false);
+		op->start(reactor, ioready_output);
+		return conn;
+	}
+
+}
@@ -0,0 +1,292 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <tscb/async-logger>
+
+namespace tscb {
+
+	namespace {
+
+		std::atomic<uint64_t> next_logger_id(1);
+
+		/* rings of the current thread, keyed by logger id; the
+		loggers keep references as well, so a ring stays alive as
+		long as either side uses it */
+		thread_local std::vector<std::pair<uint64_t, std::shared_ptr<void> > > thread_rings;
+
+		/* limit gathered segments to what writev accepts */
+		const size_t max_segments = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+	}
+
+	async_logger::ring::ring(size_t capacity) /*throw(std::bad_alloc)*/
+		: head_(0), tail_(0), data_(new char[capacity]), capacity_(capacity)
+	{
+	}
+
+	async_logger::ring::~ring(void) noexcept
+	{
+		delete[] data_;
+	}
+
+	async_logger::async_logger(posix_reactor_service & reactor, int fd,
+		std::chrono::steady_clock::duration interval,
+		size_t ring_capacity) /*throw(std::bad_alloc)*/
+		: reactor_(reactor), fd_(fd), interval_(interval), ring_capacity_(64),
+		id_(next_logger_id.fetch_add(1, std::memory_order_relaxed)),
+		dropped_(0), wakeup_pending_(false), armed_(false),
+		wakeup_(nullptr), arm_(nullptr)
+	{
+		while (ring_capacity_ < ring_capacity) {
+			ring_capacity_ <<= 1;
+		}
+
+		wakeup_ = reactor.async_procedure([this]() {
+			wakeup_pending_.store(false, std::memory_order_relaxed);
+			drain();
+		});
+		try {
+			arm_ = reactor.async_procedure(std::bind(&async_logger::arm, this));
+		}
+		catch (...) {
+			wakeup_.disconnect();
+			throw;
+		}
+	}
+
+	async_logger::~async_logger(void) noexcept
+	{
+		timer_.disconnect();
+		arm_.disconnect();
+		wakeup_.disconnect();
+
+		/* give up on descriptors that stop accepting data rather
+		than spinning forever */
+		for (int n = 0; n < 100 && !drain(); ++n) {
+			/* retry */
+		}
+	}
+
+	async_logger::ring *
+	async_logger::thread_ring(void) noexcept
+	{
+		for (const std::pair<uint64_t, std::shared_ptr<void> > & entry : thread_rings) {
+			if (entry.first == id_) {
+				return static_cast<ring *>(entry.second.get());
+			}
+		}
+
+		/* forget rings of loggers that have been destroyed */
+		thread_rings.erase(std::remove_if(thread_rings.begin(), thread_rings.end(),
+			[](const std::pair<uint64_t, std::shared_ptr<void> > & entry)
+			{
+				return entry.second.use_count() == 1;
+			}), thread_rings.end());
+
+		try {
+			std::shared_ptr<ring> r = std::make_shared<ring>(ring_capacity_);
+			thread_rings.push_back(std::make_pair(id_, std::shared_ptr<void>(r)));
+			std::unique_lock<std::mutex> guard(rings_lock_);
+			rings_.push_back(r);
+			return r.get();
+		}
+		catch (std::bad_alloc const&) {
+			return nullptr;
+		}
+	}
+
+	bool
+	async_logger::log(const void * data, size_t size) noexcept
+	{
+		ring * r = thread_ring();
+		if (!r) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		uint64_t head = r->head_.load(std::memory_order_relaxed);
+		uint64_t tail = r->tail_.load(std::memory_order_acquire);
+		if (head + size - tail > r->capacity_) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		/* messages are stored back to back; the drain writes the
+		occupied part of the ring as one or two segments */
+		size_t pos = head & (r->capacity_ - 1);
+		size_t first = std::min(size, r->capacity_ - pos);
+		memcpy(r->data_ + pos, data, first);
+		memcpy(r->data_, reinterpret_cast<const char *>(data) + first, size - first);
+		/* sequentially consistent, pairs with the reactor clearing
+		armed_ and then looking for pending data: either it sees
+		this message, or we see the timer disarmed */
+		r->head_.store(head + size, std::memory_order_seq_cst);
+
+		if (!armed_.load(std::memory_order_seq_cst) &&
+			!armed_.exchange(true, std::memory_order_seq_cst)) {
+			arm_.set();
+		}
+
+		/* wake the reactor once when crossing half capacity, so a
+		busy thread need not wait for the next timer tick */
+		uint64_t half = r->capacity_ / 2;
+		if (head - tail < half && head + size - tail >= half) {
+			if (!wakeup_pending_.exchange(true, std::memory_order_relaxed)) {
+				wakeup_.set();
+			}
+		}
+
+		return true;
+	}
+
+	void
+	async_logger::flush(void) noexcept
+	{
+		drain();
+	}
+
+	void
+	async_logger::arm(void) noexcept
+	{
+		try {
+			timer_ = reactor_.timer(
+				std::bind(&async_logger::on_timer, this, std::placeholders::_1),
+				std::chrono::steady_clock::now() + interval_);
+		}
+		catch (std::bad_alloc const&) {
+			/* write right away instead, and let the next message
+			try again */
+			drain();
+			armed_.store(false, std::memory_order_seq_cst);
+		}
+	}
+
+	bool
+	async_logger::on_timer(std::chrono::steady_clock::time_point & now) noexcept
+	{
+		if (drain()) {
+			armed_.store(false, std::memory_order_seq_cst);
+			/* messages queued since the drain may have seen the
+			timer still armed; keep it if so */
+			if (!pending() || armed_.exchange(true, std::memory_order_seq_cst)) {
+				return false;
+			}
+		}
+		now += interval_;
+		return true;
+	}
+
+	bool
+	async_logger::pending(void) noexcept
+	{
+		std::unique_lock<std::mutex> guard(rings_lock_);
+		for (const std::shared_ptr<ring> & r : rings_) {
+			if (r->head_.load(std::memory_order_seq_cst) != r->tail_.load(std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool
+	async_logger::drain(void) noexcept
+	{
+		std::vector<std::shared_ptr<ring> > rings;
+		bool resumed = !!partial_;
+		{
+			std::unique_lock<std::mutex> guard(rings_lock_);
+			/* rings only referenced by the logger belong to threads
+			that have exited; drop them once they are empty */
+			rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+				[](const std::shared_ptr<ring> & r)
+				{
+					return r.use_count() == 1 &&
+						r->head_.load(std::memory_order_acquire) == r->tail_.load(std::memory_order_relaxed);
+				}), rings_.end());
+			try {
+				/* finish a partially written ring before anything
+				else, so messages do not interleave */
+				if (partial_) {
+					rings.push_back(partial_);
+				} else {
+					rings = rings_;
+				}
+			}
+			catch (std::bad_alloc const&) {
+				return false;
+			}
+		}
+
+		struct iovec iov[max_segments];
+		uint64_t heads[max_segments / 2];
+		size_t nrings = 0, nsegments = 0;
+		for (const std::shared_ptr<ring> & r : rings) {
+			if (nsegments + 2 > max_segments) {
+				break;
+			}
+			uint64_t head = r->head_.load(std::memory_order_acquire);
+			uint64_t tail = r->tail_.load(std::memory_order_relaxed);
+			heads[nrings++] = head;
+			if (head == tail) {
+				continue;
+			}
+			size_t pos = tail & (r->capacity_ - 1);
+			size_t used = head - tail;
+			size_t first = std::min(used, r->capacity_ - pos);
+			iov[nsegments].iov_base = r->data_ + pos;
+			iov[nsegments].iov_len = first;
+			++nsegments;
+			if (used > first) {
+				iov[nsegments].iov_base = r->data_;
+				iov[nsegments].iov_len = used - first;
+				++nsegments;
+			}
+		}
+
+		if (!nsegments) {
+			return true;
+		}
+
+		ssize_t count;
+		do {
+			count = ::writev(fd_, iov, nsegments);
+		} while (count < 0 && errno == EINTR);
+		if (count < 0) {
+			return false;
+		}
+		partial_.reset();
+
+		/* release written data to the producers, ring by ring */
+		size_t written = count;
+		bool complete = true;
+		for (size_t n = 0; n < nrings; ++n) {
+			ring & r = *rings[n];
+			uint64_t tail = r.tail_.load(std::memory_order_relaxed);
+			size_t used = heads[n] - tail;
+			if (written < used) {
+				r.tail_.store(tail + written, std::memory_order_release);
+				partial_ = rings[n];
+				complete = false;
+				break;
+			}
+			r.tail_.store(heads[n], std::memory_order_release);
+			written -= used;
+		}
+
+		return complete && !resumed && nrings == rings.size();
+	}
+
+}
@@ -0,0 +1,238 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <tscb/buffer-pool>
+
+namespace tscb {
+
+	const size_t buffer_pool::small_size;
+	const size_t buffer_pool::large_size;
+
+	void
+	pooled_buffer::release(void) noexcept
+	{
+		if (data_) {
+			pool_->release(data_, capacity_);
+			data_ = nullptr;
+			capacity_ = 0;
+			size_ = 0;
+		}
+	}
+
+	buffer_pool::buffer_pool(size_t max_cached_bytes) noexcept
+		: max_cached_bytes_(max_cached_bytes)
+	{
+		small_.free_ = nullptr;
+		small_.count_ = 0;
+		small_.remote_.store(nullptr, std::memory_order_relaxed);
+		large_.free_ = nullptr;
+		large_.count_ = 0;
+		large_.remote_.store(nullptr, std::memory_order_relaxed);
+	}
+
+	buffer_pool::buffer_pool(std::thread::id owner, size_t max_cached_bytes) noexcept
+		: buffer_pool(max_cached_bytes)
+	{
+		owner_ = owner;
+	}
+
+	buffer_pool::~buffer_pool(void) noexcept
+	{
+		trim();
+		free_list(small_.remote_.exchange(nullptr, std::memory_order_acquire));
+		free_list(large_.remote_.exchange(nullptr, std::memory_order_acquire));
+	}
+
+	pooled_buffer
+	buffer_pool::acquire(size_t size) /*throw(std::bad_alloc)*/
+	{
+		size_class * cls;
+		if (size <= small_size) {
+			cls = &small_;
+			size = small_size;
+		} else if (size <= large_size) {
+			cls = &large_;
+			size = large_size;
+		} else {
+			return pooled_buffer(new char[size], size, this);
+		}
+
+		if (owner_ != std::thread::id()) {
+			if (!cls->free_) {
+				collect_remote(*cls, size);
+			}
+			if (cls->free_) {
+				char * data = static_cast<char *>(cls->free_);
+				cls->free_ = *reinterpret_cast<void **>(data);
+				cls->count_--;
+				return pooled_buffer(data, size, this);
+			}
+			return pooled_buffer(new char[size], size, this);
+		}
+
+		{
+			std::unique_lock<std::mutex> guard(lock_);
+			if (cls->free_) {
+				char * data = static_cast<char *>(cls->free_);
+				/* free buffers store the link to the next one in
+				their first bytes */
+				cls->free_ = *reinterpret_cast<void **>(data);
+				cls->count_--;
+				return pooled_buffer(data, size, this);
+			}
+		}
+
+		return pooled_buffer(new char[size], size, this);
+	}
+
+	void
+	buffer_pool::release(char * data, size_t capacity) noexcept
+	{
+		size_class * cls;
+		if (capacity == small_size) {
+			cls = &small_;
+		} else if (capacity == large_size) {
+			cls = &large_;
+		} else {
+			delete[] data;
+			return;
+		}
+
+		if (owner_ != std::thread::id()) {
+			if (std::this_thread::get_id() != owner_) {
+				/* the owner takes the whole list at once, so plain
+				pushes do not suffer from ABA */
+				void * head = cls->remote_.load(std::memory_order_relaxed);
+				do {
+					*reinterpret_cast<void **>(data) = head;
+				} while (!cls->remote_.compare_exchange_weak(head, data,
+					std::memory_order_release, std::memory_order_relaxed));
+				return;
+			}
+			if ((cls->count_ + 1) * capacity <= max_cached_bytes_) {
+				*reinterpret_cast<void **>(data) = cls->free_;
+				cls->free_ = data;
+				cls->count_++;
+				return;
+			}
+			delete[] data;
+			return;
+		}
+
+		{
+			std::unique_lock<std::mutex> guard(lock_);
+			if ((cls->count_ + 1) * capacity <= max_cached_bytes_) {
+				*reinterpret_cast<void **>(data) = cls->free_;
+				cls->free_ = data;
+				cls->count_++;
+				return;
+			}
+		}
+
+		delete[] data;
+	}
+
+	void
+	buffer_pool::collect_remote(size_class & cls, size_t capacity) noexcept
+	{
+		void * list = cls.remote_.exchange(nullptr, std::memory_order_acquire);
+		while (list) {
+			char * data = static_cast<char *>(list);
+			list = *reinterpret_cast<void **>(data);
+			if ((cls.count_ + 1) * capacity <= max_cached_bytes_) {
+				*reinterpret_cast<void **>(data) = cls.free_;
+				cls.free_ = data;
+				cls.count_++;
+			} else {
+				delete[] data;
+			}
+		}
+	}
+
+	void
+	buffer_pool::free_list(void * list) noexcept
+	{
+		while (list) {
+			char * data = static_cast<char *>(list);
+			list = *reinterpret_cast<void **>(data);
+			delete[] data;
+		}
+	}
+
+	void
+	buffer_pool::trim(void) noexcept
+	{
+		void * small_list, * large_list;
+		{
+			std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+			if (owner_ == std::thread::id()) {
+				guard.lock();
+			}
+			small_list = small_.free_;
+			large_list = large_.free_;
+			small_.free_ = large_.free_ = nullptr;
+			small_.count_ = large_.count_ = 0;
+		}
+
+		free_list(small_list);
+		free_list(large_list);
+	}
+
+	size_t
+	buffer_pool::cached(void) const noexcept
+	{
+		std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+		if (owner_ == std::thread::id()) {
+			guard.lock();
+		}
+		return small_.count_ + large_.count_;
+	}
+
+	namespace {
+
+		void
+		pooled_read(buffer_pool & pool, int fd, size_t buffer_size,
+			const std::function<void(pooled_buffer &, ssize_t, int)> & handler,
+			ioready_events /*events*/)
+		{
+			pooled_buffer buffer = pool.acquire(buffer_size);
+
+			ssize_t result;
+			do {
+				result = ::read(fd, buffer.data(), buffer.capacity());
+			} while (result < 0 && errno == EINTR);
+
+			if (result < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					/* spurious wakeup; buffer goes straight back */
+					return;
+				}
+				handler(buffer, result, errno);
+				return;
+			}
+
+			buffer.resize(result);
+			handler(buffer, result, 0);
+		}
+
+	}
+
+	ioready_connection
+	watch_pooled_read(ioready_service & io, buffer_pool & pool, int fd,
+		std::function<void(pooled_buffer & buffer, ssize_t result, int error)> handler,
+		size_t buffer_size) /*throw(std::bad_alloc)*/
+	{
+		return io.watch(
+			std::bind(pooled_read, std::ref(pool), fd, buffer_size, std::move(handler), std::placeholders::_1),
+			fd, ioready_input);
+	}
+
+}
@@ -0,0 +1,129 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <stdexcept>
+
+#include <tscb/cpu-steering-acceptor>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+namespace tscb {
+
+	namespace {
+
+		/* bound the work done per readiness event, the listener
+		stays readable if more connections are pending */
+		const size_t max_accept_batch = 64;
+
+		/* pause before retrying after running out of descriptors
+		or memory; the listener is level-triggered and would
+		otherwise be reported readable again right away */
+		const std::chrono::milliseconds accept_backoff(100);
+
+	}
+
+	cpu_steering_acceptor::cpu_steering_acceptor(posix_reactor_service & service, int listener,
+		const std::vector<pinned_reactor_thread *> & threads,
+		connection_handler handler)
+		/*throw(std::bad_alloc, std::invalid_argument)*/
+		: service_(service), listener_(listener), next_(0), handler_(std::move(handler)), steered_(0), unsteered_(0)
+	{
+		if (threads.empty()) {
+			throw std::invalid_argument("No reactor threads to steer connections to");
+		}
+
+		for (pinned_reactor_thread * thread : threads) {
+			reactors_.push_back(&thread->reactor());
+			int cpu = thread->placement().cpu;
+			if (cpu < 0) {
+				continue;
+			}
+			if (size_t(cpu) >= by_cpu_.size()) {
+				by_cpu_.resize(cpu + 1, nullptr);
+			}
+			if (!by_cpu_[cpu]) {
+				by_cpu_[cpu] = &thread->reactor();
+			}
+		}
+
+		link_ = service.watch(
+			std::bind(&cpu_steering_acceptor::handle_accept, this, std::placeholders::_1),
+			listener_, ioready_input);
+	}
+
+	cpu_steering_acceptor::~cpu_steering_acceptor(void) noexcept
+	{
+		backoff_.disconnect();
+		link_.disconnect();
+	}
+
+	bool
+	cpu_steering_acceptor::resume(std::chrono::steady_clock::time_point & /*now*/) noexcept
+	{
+		link_.modify(ioready_input);
+		return false;
+	}
+
+	posix_reactor &
+	cpu_steering_acceptor::select_reactor(int fd) noexcept
+	{
+		int cpu = -1;
+		socklen_t len = sizeof(cpu);
+		if (::getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+			cpu >= 0 && size_t(cpu) < by_cpu_.size() && by_cpu_[cpu]) {
+			steered_.fetch_add(1, std::memory_order_relaxed);
+			return *by_cpu_[cpu];
+		}
+
+		unsteered_.fetch_add(1, std::memory_order_relaxed);
+		posix_reactor & reactor = *reactors_[next_];
+		next_ = (next_ + 1) % reactors_.size();
+		return reactor;
+	}
+
+	void
+	cpu_steering_acceptor::handle_accept(ioready_events /*events*/) noexcept
+	{
+		for (size_t n = 0; n < max_accept_batch; ++n) {
+			int fd = ::accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				if (errno == EMFILE || errno == ENFILE || errno == ENOMEM || errno == ENOBUFS) {
+					try {
+						backoff_ = service_.timer(
+							std::bind(&cpu_steering_acceptor::resume, this, std::placeholders::_1),
+							std::chrono::steady_clock::now() + accept_backoff);
+						link_.modify(ioready_none);
+					}
+					catch (std::bad_alloc const &) {
+						/* retry on the next readiness event */
+					}
+				}
+				return;
+			}
+
+			posix_reactor & reactor = select_reactor(fd);
+			try {
+				connection_handler handler = handler_;
+				reactor.post([handler, fd, &reactor]() { handler(fd, reactor); });
+			}
+			catch (std::bad_alloc const &) {
+				::close(fd);
+			}
+		}
+	}
+
+}
@@ -7,65 +7,353 @@
  */
 
 #include <memory>
+#include <vector>
 
 #include <tscb/dispatch>
+#include <tscb/worker-pool>
 
 namespace tscb {
 
 	void dispatch(tscb::timerqueue_dispatcher *tq,
 		tscb::ioready_dispatcher * io)
 	{
-		/* if there are no timers pending, avoid call to gettimeofday
-		it is debatable whether this should be considered fast-path
-		or not -- however a mispredicted branch is lost in the noise
-		compared to the call to gettimeofday
-		*/
-		if (__builtin_expect(!tq->timers_pending(), true)) {
-			io->dispatch(nullptr);
-			return;
+		dispatch(tq, io, std::function<void(void)>());
+	}
+
+	void dispatch(tscb::timerqueue_dispatcher *tq,
+		tscb::ioready_dispatcher * io,
+		const std::function<void(void)> & before_wait)
+	{
+		generic_dispatch(tq, io, before_wait);
+	}
+
+	/** \cond NEVER -- internal classes, ignored by doxygen */
+
+	class offload_state : public std::enable_shared_from_this<offload_state> {
+	public:
+		offload_state(workqueue_service & reactor)
+			: reactor_(reactor), drain_pending_(false), shutdown_(false)
+		{
 		}
 
-		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-		std::chrono::steady_clock::time_point t = now;
-		bool pending;
-		do {
-			t = now;
-			pending = tq->run_queue(t);
-			if (!pending) {
-				break;
+		void execute(const std::function<void(void)> & function,
+			std::function<void(void)> & completion) noexcept
+		{
+			function();
+
+			std::unique_lock<std::mutex> guard(mutex_);
+			if (shutdown_) {
+				return;
+			}
+			try {
+				completed_.push_back(std::move(completion));
+			}
+			catch (std::bad_alloc const&) {
+				/* nothing sensible to do on a worker thread */
+				return;
+			}
+			/* only the first completion of a batch needs to
+			notify the reactor; posting under the lock keeps
+			the reactor from going away meanwhile */
+			if (!drain_pending_) {
+				try {
+					reactor_.post(std::bind(&offload_state::drain, shared_from_this()));
+					drain_pending_ = true;
+				}
+				catch (std::bad_alloc const&) {
+					/* left queued for the next completion to post */
+				}
 			}
-			now = std::chrono::steady_clock::now();
-		} while(now >= t);
+		}
 
-		if (pending) {
-			std::chrono::steady_clock::duration timeout = t - now;
-			io->dispatch(&timeout);
-		} else io->dispatch(nullptr);
-	}
+		void drain(void)
+		{
+			std::vector<std::function<void(void)> > completed;
+			std::unique_lock<std::mutex> guard(mutex_);
+			drain_pending_ = false;
+			completed.swap(completed_);
+			guard.unlock();
+
+			for (std::function<void(void)> & completion : completed) {
+				completion();
+			}
+		}
+
+		workqueue_service & reactor_;
+		std::mutex mutex_;
+		std::vector<std::function<void(void)> > completed_;
+		bool drain_pending_;
+		bool shutdown_;
+	};
+
+	/** \endcond */
 
 	posix_reactor::posix_reactor(void)
 		: io_(ioready_dispatcher::create()),
 		trigger_(io_->get_eventtrigger()),
 		timer_dispatcher_(trigger_),
-		async_workqueue_(trigger_)
+		workqueue_depth_(0),
+		workqueue_capacity_(0),
+		workqueue_space_waiters_(0),
+		workitem_cache_(nullptr),
+		workitem_cache_size_(0),
+		workitem_cache_limit_(0),
+		async_workqueue_(trigger_),
+		offload_state_(std::make_shared<offload_state>(*this))
 	{
 	}
 
 	posix_reactor::~posix_reactor(void) noexcept
 	{
+		{
+			std::unique_lock<std::mutex> guard(offload_state_->mutex_);
+			offload_state_->shutdown_ = true;
+		}
+		while (workitem_cache_) {
+			workitem * next = workitem_cache_->next_;
+			delete workitem_cache_;
+			workitem_cache_ = next;
+		}
 		delete io_;
 	}
 
+	int
+	posix_reactor::pollable_fd(void) const noexcept
+	{
+		return io_->pollable_fd();
+	}
+
+	std::chrono::steady_clock::duration
+	posix_reactor::prepare(void)
+	{
+		before_wait_();
+
+		/* announce waiting before looking at the queues: anything
+		posted afterwards raises the trigger, which now makes the
+		pollable descriptor readable */
+		if (!io_->prepare_external_wait() || !workqueue_.empty()) {
+			return std::chrono::steady_clock::duration::zero();
+		}
+
+		std::chrono::steady_clock::time_point first_timer_due;
+		if (!timer_dispatcher_.next_timer(first_timer_due)) {
+			return std::chrono::steady_clock::duration::max();
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (first_timer_due <= now) {
+			return std::chrono::steady_clock::duration::zero();
+		}
+		return first_timer_due - now;
+	}
+
+	void
+	posix_reactor::check(void) noexcept
+	{
+		io_->finish_external_wait();
+	}
+
+	void
+	posix_reactor::after_fork_child(void) /*throw(std::bad_alloc, std::runtime_error)*/
+	{
+		io_->after_fork_child();
+		/* the recreated trigger starts out cleared; make sure work
+		queued before the fork is not left waiting */
+		trigger_.set();
+	}
+
+	void
+	posix_reactor::compact(void) noexcept
+	{
+		io_->compact();
+	}
+
+	std::vector<int>
+	posix_reactor::registered_descriptors(void) /*throw(std::bad_alloc)*/
+	{
+		return io_->registered_descriptors();
+	}
+
+	bool
+	posix_reactor::offload(std::function<void(void)> function,
+		std::function<void(void)> completion) /*throw(std::bad_alloc)*/
+	{
+		return offload(worker_pool::shared(), std::move(function), std::move(completion));
+	}
+
+	bool
+	posix_reactor::offload(worker_pool & pool, std::function<void(void)> function,
+		std::function<void(void)> completion) /*throw(std::bad_alloc)*/
+	{
+		return pool.try_post(std::bind(&offload_state::execute, offload_state_,
+			std::move(function), std::move(completion)));
+	}
+
 	void
 	posix_reactor::post(std::function<void(void)> function) /*throw(std::bad_alloc)*/
 	{
 		{
-			std::unique_ptr<workitem> item(new workitem(std::move(function)));
+			std::unique_lock<std::mutex> guard(workqueue_lock_, std::defer_lock);
+			push_workitem(make_workitem(guard, function));
+		}
+		trigger_.set();
+	}
+
+	void
+	posix_reactor::set_workqueue_capacity(size_t capacity) noexcept
+	{
+		std::unique_lock<std::mutex> guard(workqueue_lock_);
+		workqueue_capacity_ = capacity;
+		if (workqueue_space_waiters_) {
+			workqueue_space_.notify_all();
+		}
+	}
+
+	bool
+	posix_reactor::try_post(std::function<void(void)> function) /*throw(std::bad_alloc)*/
+	{
+		{
+			/* refuse before obtaining a node, shedding load should
+			be cheap */
 			std::unique_lock<std::mutex> guard(workqueue_lock_);
-			workqueue_.push_back(item.get());
-			item.release();
+			if (workqueue_full()) {
+				return false;
+			}
+			workitem * item = make_workitem(guard, function);
+			/* the lock may have been dropped for allocation */
+			if (workqueue_full()) {
+				release_workitem(item);
+				return false;
+			}
+			push_workitem(item);
 		}
 		trigger_.set();
+		return true;
+	}
+
+	void
+	posix_reactor::post_when_space(std::function<void(void)> function) /*throw(std::bad_alloc)*/
+	{
+		{
+			std::unique_lock<std::mutex> guard(workqueue_lock_);
+			wait_for_workqueue_space(guard);
+			workitem * item = make_workitem(guard, function);
+			/* the lock may have been dropped for allocation */
+			wait_for_workqueue_space(guard);
+			push_workitem(item);
+		}
+		trigger_.set();
+	}
+
+	void
+	posix_reactor::reserve_workitems(size_t count) /*throw(std::bad_alloc)*/
+	{
+		workitem * nodes = nullptr;
+		try {
+			for (size_t n = 0; n < count; ++n) {
+				workitem * item = new workitem(nullptr);
+				item->next_ = nodes;
+				nodes = item;
+			}
+		}
+		catch (...) {
+			while (nodes) {
+				workitem * next = nodes->next_;
+				delete nodes;
+				nodes = next;
+			}
+			throw;
+		}
+
+		std::unique_lock<std::mutex> guard(workqueue_lock_);
+		workitem_cache_limit_.store(count, std::memory_order_relaxed);
+		/* fresh nodes first, so that any nodes kept before are the
+		ones freed if the limit shrinks */
+		while (nodes) {
+			workitem * next = nodes->next_;
+			nodes->next_ = workitem_cache_;
+			workitem_cache_ = nodes;
+			++workitem_cache_size_;
+			nodes = next;
+		}
+		while (workitem_cache_size_ > count) {
+			workitem * next = workitem_cache_->next_;
+			delete workitem_cache_;
+			workitem_cache_ = next;
+			--workitem_cache_size_;
+		}
+	}
+
+	void
+	posix_reactor::wait_for_workqueue_space(std::unique_lock<std::mutex> & guard) noexcept
+	{
+		++workqueue_space_waiters_;
+		while (workqueue_full()) {
+			workqueue_space_.wait(guard);
+		}
+		--workqueue_space_waiters_;
+	}
+
+	posix_reactor::workitem *
+	posix_reactor::make_workitem(std::unique_lock<std::mutex> & guard,
+		std::function<void(void)> & function) /*throw(std::bad_alloc)*/
+	{
+		if (!guard.owns_lock()) {
+			guard.lock();
+		}
+		workitem * item = workitem_cache_;
+		if (item) {
+			workitem_cache_ = item->next_;
+			--workitem_cache_size_;
+			item->function_ = std::move(function);
+			return item;
+		}
+		guard.unlock();
+
+		item = new workitem(std::move(function));
+		guard.lock();
+		return item;
+	}
+
+	void
+	posix_reactor::release_workitem(workitem * item) noexcept
+	{
+		if (workitem_cache_size_ < workitem_cache_limit_.load(std::memory_order_relaxed)) {
+			item->function_ = nullptr;
+			item->next_ = workitem_cache_;
+			workitem_cache_ = item;
+			++workitem_cache_size_;
+		} else {
+			delete item;
+		}
+	}
+
+	void
+	posix_reactor::recycle_workitem(workitem * item) noexcept
+	{
+		if (__builtin_expect(!workitem_cache_limit_.load(std::memory_order_relaxed), true)) {
+			delete item;
+			return;
+		}
+		/* destroy bound arguments outside the lock */
+		item->function_ = nullptr;
+		std::unique_lock<std::mutex> guard(workqueue_lock_);
+		release_workitem(item);
+	}
+
+	posix_reactor::workitem *
+	posix_reactor::pop_workitem(void) noexcept
+	{
+		std::unique_lock<std::mutex> guard(workqueue_lock_);
+		workitem * item = workqueue_.pop();
+		if (item) {
+			workqueue_depth_.store(workqueue_depth_.load(std::memory_order_relaxed) - 1,
+				std::memory_order_relaxed);
+			if (workqueue_space_waiters_) {
+				workqueue_space_.notify_one();
+			}
+		}
+		return item;
 	}
 
 	void posix_reactor::register_timer(timer_callback * cb) noexcept
@@ -112,50 +400,64 @@ namespace tscb {
 	posix_reactor::dispatch(void)
 	{
 		if (__builtin_expect(!workqueue_.empty(), 0)) {
-			std::unique_lock<std::mutex> guard(workqueue_lock_);
-			std::unique_ptr<workitem> item(workqueue_.pop());
-			guard.unlock();
+			std::unique_ptr<workitem> item(pop_workitem());
 
 			if (item.get()) {
 				item->function_();
-			}
-
-			guard.lock();
-			if (!workqueue_.empty()) {
+				recycle_workitem(item.release());
+				/* the work item counts as the event handled by
+				this call, so only poll for io below. Setting the
+				trigger merely when more items are queued is not
+				enough: the wakeup announcing this item may have
+				been consumed already (e.g. by the io poll of
+				dispatch_pending), and the io wait would then
+				block with work done and possibly more queued */
 				trigger_.set();
+			} else {
+				std::unique_lock<std::mutex> guard(workqueue_lock_);
+				if (!workqueue_.empty()) {
+					trigger_.set();
+				}
 			}
-			guard.unlock();
 		}
 		async_workqueue_.dispatch();
-		tscb::dispatch(&timer_dispatcher_, io_);
+
+		/* reference wrapper: stored in place, no allocation */
+		tscb::dispatch(&timer_dispatcher_, io_, std::ref(before_wait_));
 	}
 
 	bool
-	posix_reactor::dispatch_pending(void)
+	posix_reactor::dispatch_workqueues(void)
 	{
 		bool processed_events = false;
 
 		if (__builtin_expect(!workqueue_.empty(), 0)) {
-			std::unique_lock<std::mutex> guard(workqueue_lock_);
-			std::unique_ptr<workitem> item(workqueue_.pop());
-			guard.unlock();
+			std::unique_ptr<workitem> item(pop_workitem());
 
 			if (item.get()) {
 				item->function_();
+				recycle_workitem(item.release());
 				processed_events = true;
 			}
 
-			guard.lock();
+			std::unique_lock<std::mutex> guard(workqueue_lock_);
 			if (!workqueue_.empty()) {
 				trigger_.set();
 			}
-			guard.unlock();
 		}
 
 		if (async_workqueue_.dispatch()) {
 			processed_events = true;
 		}
 
+		return processed_events;
+	}
+
+	bool
+	posix_reactor::dispatch_pending(void)
+	{
+		bool processed_events = dispatch_workqueues();
+
 		std::chrono::steady_clock::time_point first_timer_due;
 		if (__builtin_expect(timer_dispatcher_.next_timer(first_timer_due), false)) {
 			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
@@ -181,4 +483,10 @@ namespace tscb {
 		}
 	}
 
+	connection
+	posix_reactor::before_wait(std::function<void(void)> function) /*throw(std::bad_alloc)*/
+	{
+		return before_wait_.connect(std::move(function));
+	}
+
 }
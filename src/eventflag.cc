@@ -146,4 +146,26 @@ namespace tscb {
 		} while (res == -1 && errno == EAGAIN);
 	}
 
+	void pipe_eventflag::recreate(void) /*throw(std::runtime_error)*/
+	{
+		int filedes[2];
+
+		auto error = ::pipe2(filedes, O_CLOEXEC);
+		if (error) {
+			throw std::runtime_error("Unable to create control pipe");
+		}
+
+		/* keep descriptor numbers, they may be registered elsewhere */
+		if (::dup3(filedes[0], readfd_, O_CLOEXEC) < 0 || ::dup3(filedes[1], writefd_, O_CLOEXEC) < 0) {
+			::close(filedes[0]);
+			::close(filedes[1]);
+			throw std::runtime_error("Unable to replace control pipe");
+		}
+		::close(filedes[0]);
+		::close(filedes[1]);
+
+		flagged_.store(0, std::memory_order_relaxed);
+		waiting_.store(0, std::memory_order_relaxed);
+	}
+
 }
@@ -7,6 +7,9 @@
  */
 
 #include <string.h>
+
+#include <algorithm>
+
 #include <tscb/config>
 #include <tscb/file-descriptor-table>
 
@@ -38,6 +41,11 @@ namespace tscb {
 		file_descriptor_chain * entry = tab->entries_[cb->fd_].load(std::memory_order_relaxed);
 		if (!entry) {
 			entry = new file_descriptor_chain;
+			/* the slot may have been in use before (and its chain
+			freed in synchronize); start with the current cookie so
+			that events collected for the previous user of the
+			descriptor are still discarded */
+			entry->cookie_.store(cookie_.load(std::memory_order_relaxed), std::memory_order_relaxed);
 			tab->entries_[cb->fd_].store(entry, std::memory_order_relaxed);
 		}
 
@@ -171,6 +179,12 @@ namespace tscb {
 			} else {
 				entry->last_ = link->prev_;
 			}
+			/* no readers exist during synchronization, so a chain
+			that lost its last callback can be freed right away */
+			if (!entry->first_) {
+				tab->entries_[link->fd_].store(nullptr, std::memory_order_relaxed);
+				delete entry;
+			}
 			link = link->inactive_next_;
 		}
 
@@ -186,6 +200,11 @@ namespace tscb {
 			}
 		}
 
+		if (need_compact_) {
+			need_compact_ = false;
+			compact();
+		}
+
 		/* return first inactive callback so they can be deallocated
 		outside the lock */
 		link = inactive_;
@@ -214,4 +233,40 @@ namespace tscb {
 		return tab;
 	}
 
+	/* must be called during synchronization */
+	void file_descriptor_table::compact(void) noexcept
+	{
+		volatile_table * tab = table_.load(std::memory_order_relaxed);
+
+		size_t used = 0;
+		for (size_t n = tab->capacity_; n > 0; --n) {
+			if (tab->entries_[n - 1].load(std::memory_order_relaxed)) {
+				used = n;
+				break;
+			}
+		}
+
+		/* leave room for growth, avoid shrinking for little gain */
+		size_t new_capacity = std::max(min_capacity_, 2 * used);
+		if (new_capacity * 2 > tab->capacity_) {
+			return;
+		}
+
+		volatile_table * newtab;
+		try {
+			newtab = new volatile_table(new_capacity);
+		}
+		catch (std::bad_alloc const&) {
+			return;
+		}
+		for (size_t n = 0; n < used; ++n) {
+			newtab->entries_[n].store(tab->entries_[n].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		/* no readers exist during synchronization, so the old table
+		can be released immediately */
+		table_.store(newtab, std::memory_order_release);
+		delete tab;
+	}
+
 }
@@ -0,0 +1,311 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <condition_variable>
+
+#include <tscb/file-io>
+
+namespace tscb {
+
+	/** \cond NEVER -- internal classes, ignored by doxygen */
+
+	class file_io_request {
+	public:
+		enum operation_type {
+			op_pread,
+			op_pwrite,
+			op_fsync
+		};
+
+		file_io_request(operation_type op, int fd, void * buffer, size_t count, off_t offset,
+			async_io_completion completion)
+			: op_(op), fd_(fd), buffer_(buffer), count_(count), offset_(offset),
+			completion_(std::move(completion)), result_(-1), error_(0), next_(nullptr)
+		{
+		}
+
+		void execute(void) noexcept
+		{
+			ssize_t result;
+			do {
+				switch (op_) {
+					case op_pread:
+						result = ::pread(fd_, buffer_, count_, offset_);
+						break;
+					case op_pwrite:
+						result = ::pwrite(fd_, buffer_, count_, offset_);
+						break;
+					default:
+						result = ::fsync(fd_);
+						break;
+				}
+			} while (result < 0 && errno == EINTR);
+
+			result_ = result;
+			error_ = result < 0 ? errno : 0;
+		}
+
+		operation_type op_;
+		int fd_;
+		void * buffer_;
+		size_t count_;
+		off_t offset_;
+		async_io_completion completion_;
+		ssize_t result_;
+		int error_;
+		file_io_request * next_;
+	};
+
+	class file_io_request_list {
+	public:
+		file_io_request_list(void) : first_(nullptr), last_(nullptr) {}
+
+		~file_io_request_list(void) noexcept
+		{
+			while (first_) {
+				file_io_request * next = first_->next_;
+				delete first_;
+				first_ = next;
+			}
+		}
+
+		inline void push_back(file_io_request * req) noexcept
+		{
+			req->next_ = nullptr;
+			if (last_) {
+				last_->next_ = req;
+				last_ = req;
+			} else {
+				first_ = last_ = req;
+			}
+		}
+
+		/* put a chain of requests taken before back in front */
+		inline void push_front(file_io_request * chain) noexcept
+		{
+			if (!chain) {
+				return;
+			}
+			file_io_request * tail = chain;
+			while (tail->next_) {
+				tail = tail->next_;
+			}
+			tail->next_ = first_;
+			if (!first_) {
+				last_ = tail;
+			}
+			first_ = chain;
+		}
+
+		inline file_io_request * take(void) noexcept
+		{
+			file_io_request * tmp = first_;
+			first_ = last_ = nullptr;
+			return tmp;
+		}
+
+		file_io_request * first_;
+		file_io_request * last_;
+	};
+
+	class file_io_state : public std::enable_shared_from_this<file_io_state> {
+	public:
+		file_io_state(workqueue_service & completion_queue, worker_pool & pool)
+			: completion_queue_(completion_queue), pool_(pool), running_(0),
+			flush_pending_(false), drain_pending_(false), shutdown_(false)
+		{
+		}
+
+		void submit(std::unique_ptr<file_io_request> req)
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			if (!flush_pending_) {
+				/* first submission of this loop iteration; everything
+				submitted until the reactor gets around to processing
+				this is handed to the pool in one batch. The flush is
+				posted before the request is published, so a failure
+				leaves nothing behind */
+				completion_queue_.post(std::bind(&file_io_state::flush, shared_from_this()));
+				flush_pending_ = true;
+			}
+			submitted_.push_back(req.release());
+		}
+
+		void flush(void)
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			flush_pending_ = false;
+			file_io_request * req = submitted_.take();
+			bool shutdown = shutdown_;
+			guard.unlock();
+
+			if (shutdown) {
+				/* service is gone, buffers may be gone as well */
+				while (req) {
+					file_io_request * next = req->next_;
+					delete req;
+					req = next;
+				}
+				return;
+			}
+
+			try {
+				std::vector<std::function<void(void)> > batch;
+				for (file_io_request * tmp = req; tmp; tmp = tmp->next_) {
+					batch.push_back(std::bind(&file_io_state::execute, shared_from_this(), tmp));
+				}
+				pool_.post_batch(batch);
+			}
+			catch (std::bad_alloc const&) {
+				/* nothing has been handed to the pool; fail all
+				requests, completing them right here (this runs
+				in the completion queue already) */
+				guard.lock();
+				for (file_io_request * tmp = req; tmp; tmp = tmp->next_) {
+					tmp->result_ = -1;
+					tmp->error_ = ENOMEM;
+				}
+				completed_.push_front(req);
+				guard.unlock();
+				drain();
+			}
+		}
+
+		void execute(file_io_request * req) noexcept
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			if (shutdown_) {
+				/* buffers and completion queue may be gone */
+				guard.unlock();
+				delete req;
+				return;
+			}
+			++running_;
+			guard.unlock();
+
+			req->execute();
+
+			guard.lock();
+			--running_;
+			if (shutdown_) {
+				idle_.notify_all();
+				guard.unlock();
+				delete req;
+				return;
+			}
+			completed_.push_back(req);
+			if (!drain_pending_) {
+				/* posting under the lock keeps the completion
+				queue from going away meanwhile */
+				try {
+					completion_queue_.post(std::bind(&file_io_state::drain, shared_from_this()));
+					drain_pending_ = true;
+				}
+				catch (std::bad_alloc const&) {
+					/* left queued for the next completion to post */
+				}
+			}
+		}
+
+		void shutdown(void) noexcept
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			shutdown_ = true;
+			/* requests running now write to buffers of the caller */
+			while (running_) {
+				idle_.wait(guard);
+			}
+		}
+
+		void drain(void)
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			drain_pending_ = false;
+			file_io_request * req = completed_.take();
+			bool shutdown = shutdown_;
+			guard.unlock();
+
+			while (req) {
+				std::unique_ptr<file_io_request> current(req);
+				req = req->next_;
+				if (!shutdown) {
+					try {
+						current->completion_(current->result_, current->error_);
+					}
+					catch (...) {
+						/* keep the remaining completions for another
+						round instead of dropping them */
+						guard.lock();
+						completed_.push_front(req);
+						if (req && !drain_pending_) {
+							try {
+								completion_queue_.post(std::bind(&file_io_state::drain, shared_from_this()));
+								drain_pending_ = true;
+							}
+							catch (std::bad_alloc const&) {
+								/* left queued for the next completion to post */
+							}
+						}
+						throw;
+					}
+				}
+			}
+		}
+
+		workqueue_service & completion_queue_;
+		worker_pool & pool_;
+
+		std::mutex mutex_;
+		std::condition_variable idle_;
+		file_io_request_list submitted_;
+		file_io_request_list completed_;
+		size_t running_;
+		bool flush_pending_;
+		bool drain_pending_;
+		bool shutdown_;
+	};
+
+	/** \endcond */
+
+	file_io_service::file_io_service(workqueue_service & completion_queue, worker_pool & pool)
+		: state_(std::make_shared<file_io_state>(completion_queue, pool))
+	{
+	}
+
+	file_io_service::~file_io_service(void) noexcept
+	{
+		state_->shutdown();
+	}
+
+	void
+	file_io_service::pread(int fd, void * buffer, size_t count, off_t offset,
+		async_io_completion completion) /*throw(std::bad_alloc)*/
+	{
+		state_->submit(std::unique_ptr<file_io_request>(new file_io_request(file_io_request::op_pread,
+			fd, buffer, count, offset, std::move(completion))));
+	}
+
+	void
+	file_io_service::pwrite(int fd, const void * buffer, size_t count, off_t offset,
+		async_io_completion completion) /*throw(std::bad_alloc)*/
+	{
+		state_->submit(std::unique_ptr<file_io_request>(new file_io_request(file_io_request::op_pwrite,
+			fd, const_cast<void *>(buffer), count, offset, std::move(completion))));
+	}
+
+	void
+	file_io_service::fsync(int fd, async_io_completion completion) /*throw(std::bad_alloc)*/
+	{
+		state_->submit(std::unique_ptr<file_io_request>(new file_io_request(file_io_request::op_fsync,
+			fd, nullptr, 0, 0, std::move(completion))));
+	}
+
+}
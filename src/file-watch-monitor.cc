@@ -0,0 +1,352 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <stdexcept>
+
+#include <tscb/file-watch-monitor>
+
+namespace tscb {
+
+	file_watch_service::~file_watch_service(void) noexcept
+	{
+	}
+
+	file_watch_callback::~file_watch_callback(void) noexcept
+	{
+	}
+
+	void file_watch_callback::disconnect(void) noexcept
+	{
+		registration_mutex_.lock();
+		if (service_) {
+			service_->remove(this);
+		} else {
+			registration_mutex_.unlock();
+		}
+	}
+
+	bool file_watch_callback::connected(void) const noexcept
+	{
+		std::unique_lock<std::mutex> guard(registration_mutex_);
+		return service_ != nullptr;
+	}
+
+	file_watch_monitor::file_watch_monitor(ioready_service & io) /*throw(std::bad_alloc, std::runtime_error)*/
+		: fd_(-1), active_(nullptr), first_(nullptr), last_(nullptr), deferred_cancel_(nullptr)
+	{
+		fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd_ < 0) {
+			throw std::runtime_error("Unable to create inotify descriptor");
+		}
+
+		try {
+			link_ = io.watch(std::bind(&file_watch_monitor::dispatch, this), fd_, ioready_input);
+		}
+		catch (...) {
+			::close(fd_);
+			throw;
+		}
+	}
+
+	file_watch_monitor::~file_watch_monitor(void) noexcept
+	{
+		link_.disconnect();
+
+		while(lock_.read_lock()) {
+			synchronize();
+		}
+
+		for(;;) {
+			file_watch_callback * cb = active_.load(std::memory_order_relaxed);
+			if (!cb) {
+				break;
+			}
+			cb->disconnect();
+		}
+		if (lock_.read_unlock()) {
+			synchronize();
+		} else {
+			lock_.write_lock_sync();
+			synchronize();
+		}
+
+		::close(fd_);
+	}
+
+	connection
+	file_watch_monitor::watch_file(std::function<void(uint32_t, const char *)> function,
+		const std::string & path, uint32_t event_mask)
+	{
+		file_watch_callback * cb = new file_watch_callback(event_mask, std::move(function));
+		cb->path_ = path;
+
+		cb->registration_mutex_.lock();
+		bool sync = lock_.write_lock_async();
+
+		/* several callbacks may watch the same file; they share the
+		watch descriptor, which receives the union of their masks.
+		The watch is added while holding the write lock, so
+		synchronize cannot remove it before the callback is
+		linked */
+		cb->wd_ = ::inotify_add_watch(fd_, path.c_str(), event_mask | IN_MASK_ADD);
+		struct stat st;
+		if (cb->wd_ < 0 || ::stat(path.c_str(), &st) < 0) {
+			cb->registration_mutex_.unlock();
+			if (sync) {
+				synchronize();
+			} else {
+				lock_.write_unlock_async();
+			}
+			delete cb;
+			throw std::runtime_error("Unable to watch file");
+		}
+		cb->dev_ = st.st_dev;
+		cb->ino_ = st.st_ino;
+
+		cb->next_ = nullptr;
+		cb->prev_ = last_;
+
+		cb->active_next_.store(nullptr, std::memory_order_relaxed);
+
+		file_watch_callback * tmp = last_;
+		for (;;) {
+			if (!tmp) {
+				if (!active_.load(std::memory_order_relaxed)) {
+					active_.store(cb, std::memory_order_release);
+				}
+				break;
+			}
+			if (tmp->active_next_.load(std::memory_order_relaxed)) {
+				break;
+			}
+			tmp->active_next_.store(cb, std::memory_order_release);
+			tmp = tmp->prev_;
+		}
+
+		/* insert into list of all elements*/
+		if (last_) {
+			last_->next_ = cb;
+		} else {
+			first_ = cb;
+		}
+		last_ = cb;
+
+		cb->service_ = this;
+
+		cb->registration_mutex_.unlock();
+
+		if (sync) {
+			synchronize();
+		} else {
+			lock_.write_unlock_async();
+		}
+
+		return connection(cb, true);
+	}
+
+	void
+	file_watch_monitor::dispatch(void)
+	{
+		union {
+			struct inotify_event event;
+			char data[16384];
+		} buffer;
+
+		ssize_t count;
+		do {
+			count = ::read(fd_, &buffer, sizeof(buffer));
+		} while (count < 0 && errno == EINTR);
+		if (count <= 0) {
+			return;
+		}
+
+		read_guard<file_watch_monitor> guard(*this);
+
+		const char * pos = buffer.data;
+		const char * end = buffer.data + count;
+		while (pos < end) {
+			const struct inotify_event * event = reinterpret_cast<const struct inotify_event *>(pos);
+			deliver(event->wd, event->mask, event->len ? event->name : "");
+			pos += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	void
+	file_watch_monitor::deliver(int wd, uint32_t events, const char * name)
+	{
+		file_watch_callback * current = active_.load(std::memory_order_consume);
+
+		while (current) {
+			/* overflow concerns all watches (and carries wd -1) */
+			if (current->wd_ == wd || (events & IN_Q_OVERFLOW)) {
+				if (events & (current->event_mask_ | IN_Q_OVERFLOW | IN_IGNORED)) {
+					if (events & IN_IGNORED) {
+						current->disconnect();
+					}
+					current->function_(events, name);
+				}
+			}
+
+			current = current->active_next_.load(std::memory_order_consume);
+		}
+	}
+
+	void file_watch_monitor::remove(file_watch_callback * cb) noexcept
+	{
+		bool sync = lock_.write_lock_async();
+		if (cb->service_ == this) {
+			/* remove element from active list; we have to make
+			sure that all elements that pointed to "us" within
+			the active chain now point to the following element,
+			so this element is skipped from within the active chain */
+
+			file_watch_callback * tmp = cb->prev_;
+			file_watch_callback * next = cb->active_next_.load(std::memory_order_relaxed);
+			for (;;) {
+				if (!tmp) {
+					if (active_.load(std::memory_order_relaxed) == cb) {
+						active_.store(next, std::memory_order_release);
+					}
+					break;
+				}
+				if (tmp->active_next_.load(std::memory_order_relaxed) != cb) {
+					break;
+				}
+				tmp->active_next_.store(next, std::memory_order_release);
+				tmp = tmp->prev_;
+			}
+
+			/* put on list of elements marked for deferred cancellation */
+			cb->deferred_cancel_next_ = deferred_cancel_;
+			deferred_cancel_ = cb;
+
+			cb->service_ = nullptr;
+		}
+
+		cb->registration_mutex_.unlock();
+
+		if (sync) {
+			synchronize();
+		} else {
+			lock_.write_unlock_async();
+		}
+	}
+
+	void file_watch_monitor::synchronize(void)
+	{
+		file_watch_callback * do_cancel = deferred_cancel_;
+
+		/* first, "repair" the list structure by "correcting" all prev
+		pointers */
+		while (do_cancel) {
+			/* we can now safely remove the elements from the list */
+			if (do_cancel->prev_) {
+				do_cancel->prev_->next_ = do_cancel->next_;
+			} else {
+				first_ = do_cancel->next_;
+			}
+			if (do_cancel->next_) {
+				do_cancel->next_->prev_ = do_cancel->prev_;
+			} else {
+				last_ = do_cancel->prev_;
+			}
+
+			do_cancel = do_cancel->deferred_cancel_next_;
+		}
+
+		/* drop watches no remaining callback refers to (fails
+		harmlessly for watches the kernel has removed already),
+		narrow the mask of all others to what remains of interest */
+		do_cancel = deferred_cancel_;
+		while (do_cancel) {
+			bool in_use = false;
+			for (file_watch_callback * tmp = first_; tmp; tmp = tmp->next_) {
+				if (tmp->wd_ == do_cancel->wd_) {
+					in_use = true;
+					break;
+				}
+			}
+			if (do_cancel->wd_ >= 0) {
+				if (in_use) {
+					narrow_watch(do_cancel->wd_);
+				} else {
+					::inotify_rm_watch(fd_, do_cancel->wd_);
+				}
+				/* mark handled for other callbacks sharing the watch */
+				for (file_watch_callback * tmp = do_cancel->deferred_cancel_next_; tmp; tmp = tmp->deferred_cancel_next_) {
+					if (tmp->wd_ == do_cancel->wd_) {
+						tmp->wd_ = -1;
+					}
+				}
+			}
+			do_cancel = do_cancel->deferred_cancel_next_;
+		}
+
+		/* now swap pointers while still under the lock; this is
+		necessary to make sure that the destructor for each
+		callback link object is called exactly once */
+		do_cancel = deferred_cancel_;
+		deferred_cancel_ = nullptr;
+		lock_.sync_finished();
+
+		/* now we can release the callbacks, as we are sure that no one
+		can "see" them anymore; the lock is dropped so side-effects
+		of finalizing the links cannot cause deadlocks */
+		while (do_cancel) {
+			file_watch_callback * tmp = do_cancel->deferred_cancel_next_;
+			do_cancel->cancelled();
+			do_cancel->release();
+			do_cancel = tmp;
+		}
+	}
+
+	void file_watch_monitor::narrow_watch(int wd) noexcept
+	{
+		uint32_t mask = 0;
+		const file_watch_callback * any = nullptr;
+		for (const file_watch_callback * tmp = first_; tmp; tmp = tmp->next_) {
+			if (tmp->wd_ == wd) {
+				mask |= tmp->event_mask_;
+				any = tmp;
+			}
+		}
+
+		/* inotify can only modify a watch by path; leave the mask
+		alone if the path does not name the watched file anymore,
+		as this would create (or modify) an unrelated watch.
+		Events outside a callback's mask are filtered on delivery
+		in any case. */
+		struct stat st;
+		if (::stat(any->path_.c_str(), &st) < 0 || st.st_dev != any->dev_ || st.st_ino != any->ino_) {
+			return;
+		}
+		int new_wd = ::inotify_add_watch(fd_, any->path_.c_str(), mask);
+		if (new_wd >= 0 && new_wd != wd) {
+			/* path was replaced in the meantime: restore the mask
+			of the watch hit instead, or drop it if it was created
+			just now */
+			uint32_t other_mask = 0;
+			for (const file_watch_callback * tmp = first_; tmp; tmp = tmp->next_) {
+				if (tmp->wd_ == new_wd) {
+					other_mask |= tmp->event_mask_;
+				}
+			}
+			if (other_mask) {
+				::inotify_add_watch(fd_, any->path_.c_str(), other_mask);
+			} else {
+				::inotify_rm_watch(fd_, new_wd);
+			}
+		}
+	}
+
+}
@@ -0,0 +1,278 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <tscb/framed-channel>
+
+namespace tscb {
+
+	namespace {
+
+		/* upper bound for segments gathered into one writev; two
+		per frame */
+		const size_t max_gather = IOV_MAX < 64 ? IOV_MAX : 64;
+
+	}
+
+	void
+	framed_channel::frame::copy_to(void * dest) const noexcept
+	{
+		memcpy(dest, first, first_size);
+		memcpy(reinterpret_cast<char *>(dest) + first_size, second, second_size);
+	}
+
+	framed_channel::framed_channel(ioready_service & service, int fd,
+		frame_handler on_frame, close_handler on_close,
+		size_t capacity) /*throw(std::bad_alloc)*/
+		: fd_(fd), on_frame_(std::move(on_frame)), on_close_(std::move(on_close)),
+		ring_(nullptr), capacity_(64), head_(0), tail_(0),
+		output_offset_(0), pending_output_(0), closed_(false)
+	{
+		while (capacity_ < capacity) {
+			capacity_ <<= 1;
+		}
+		ring_ = new char[capacity_];
+
+		try {
+			link_ = service.watch(
+				std::bind(&framed_channel::handle_events, this, std::placeholders::_1),
+				fd_, ioready_input);
+		}
+		catch (...) {
+			delete[] ring_;
+			throw;
+		}
+	}
+
+	framed_channel::~framed_channel(void) noexcept
+	{
+		link_.disconnect();
+		delete[] ring_;
+	}
+
+	bool
+	framed_channel::send(const void * data, size_t size) /*throw(std::bad_alloc)*/
+	{
+		if (closed_) {
+			return false;
+		}
+		const char * begin = reinterpret_cast<const char *>(data);
+		return send(std::vector<char>(begin, begin + size));
+	}
+
+	bool
+	framed_channel::send(std::vector<char> && data) /*throw(std::bad_alloc)*/
+	{
+		if (closed_) {
+			return false;
+		}
+		if (data.size() > 0xffffffff) {
+			throw std::invalid_argument("Frame too large for framed_channel");
+		}
+
+		size_t size = data.size();
+		bool was_empty = output_.empty();
+		output_.push_back(output_frame());
+		output_.back().prefix = htonl(size);
+		output_.back().data.swap(data);
+		pending_output_ += sizeof(uint32_t) + size;
+
+		if (was_empty) {
+			link_.modify(ioready_input | ioready_output);
+		}
+
+		return true;
+	}
+
+	void
+	framed_channel::close(void) noexcept
+	{
+		closed_ = true;
+		link_.disconnect();
+		output_.clear();
+		output_offset_ = 0;
+		pending_output_ = 0;
+	}
+
+	void
+	framed_channel::shutdown(int error) noexcept
+	{
+		close();
+		/* the handler may destroy the channel */
+		close_handler handler(std::move(on_close_));
+		if (handler) {
+			handler(error);
+		}
+	}
+
+	void
+	framed_channel::handle_events(ioready_events events) noexcept
+	{
+		if (closed_) {
+			return;
+		}
+		if (events & (ioready_input | ioready_hangup | ioready_error)) {
+			if (!handle_input()) {
+				return;
+			}
+		}
+		if (events & ioready_output) {
+			handle_output();
+		}
+	}
+
+	bool
+	framed_channel::handle_input(void) noexcept
+	{
+		size_t used = head_ - tail_;
+		size_t space = capacity_ - used;
+		size_t pos = head_ & (capacity_ - 1);
+
+		/* free space of the ring, wrapping around at most once */
+		struct iovec iov[2];
+		iov[0].iov_base = ring_ + pos;
+		iov[0].iov_len = std::min(space, capacity_ - pos);
+		iov[1].iov_base = ring_;
+		iov[1].iov_len = space - iov[0].iov_len;
+
+		ssize_t count;
+		do {
+			count = ::readv(fd_, iov, iov[1].iov_len ? 2 : 1);
+		} while (count < 0 && errno == EINTR);
+
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				shutdown(errno);
+				return false;
+			}
+			return true;
+		}
+		if (count == 0) {
+			shutdown(0);
+			return false;
+		}
+
+		head_ += count;
+		return parse_frames();
+	}
+
+	void
+	framed_channel::peek(uint64_t pos, void * dest, size_t size) const noexcept
+	{
+		size_t offset = pos & (capacity_ - 1);
+		size_t first = std::min(size, capacity_ - offset);
+		memcpy(dest, ring_ + offset, first);
+		memcpy(reinterpret_cast<char *>(dest) + first, ring_, size - first);
+	}
+
+	bool
+	framed_channel::parse_frames(void) noexcept
+	{
+		while (head_ - tail_ >= sizeof(uint32_t)) {
+			uint32_t length;
+			peek(tail_, &length, sizeof(uint32_t));
+			length = ntohl(length);
+
+			if (length > max_frame_size()) {
+				shutdown(EMSGSIZE);
+				return false;
+			}
+			if (head_ - tail_ < sizeof(uint32_t) + length) {
+				break;
+			}
+
+			size_t offset = (tail_ + sizeof(uint32_t)) & (capacity_ - 1);
+			frame f;
+			f.first = ring_ + offset;
+			f.first_size = std::min(size_t(length), capacity_ - offset);
+			f.second = ring_;
+			f.second_size = length - f.first_size;
+
+			tail_ += sizeof(uint32_t) + length;
+			on_frame_(f);
+			if (closed_) {
+				return false;
+			}
+		}
+
+		/* start over at the beginning of the ring when it runs
+		empty, keeping small frames contiguous */
+		if (head_ == tail_) {
+			head_ = tail_ = 0;
+		}
+
+		return true;
+	}
+
+	void
+	framed_channel::handle_output(void) noexcept
+	{
+		struct iovec iov[max_gather];
+		size_t n = 0;
+		size_t skip = output_offset_;
+		for (output_frame & f : output_) {
+			if (n + 2 > max_gather) {
+				break;
+			}
+			if (skip < sizeof(uint32_t)) {
+				iov[n].iov_base = reinterpret_cast<char *>(&f.prefix) + skip;
+				iov[n].iov_len = sizeof(uint32_t) - skip;
+				++n;
+				skip = 0;
+			} else {
+				skip -= sizeof(uint32_t);
+			}
+			if (f.data.size() > skip) {
+				iov[n].iov_base = f.data.data() + skip;
+				iov[n].iov_len = f.data.size() - skip;
+				++n;
+			}
+			skip = 0;
+		}
+
+		if (n) {
+			ssize_t count;
+			do {
+				count = ::writev(fd_, iov, n);
+			} while (count < 0 && errno == EINTR);
+
+			if (count < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					shutdown(errno);
+				}
+				return;
+			}
+
+			pending_output_ -= count;
+			size_t written = count;
+			while (written) {
+				size_t remaining = sizeof(uint32_t) + output_.front().data.size() - output_offset_;
+				if (written < remaining) {
+					output_offset_ += written;
+					break;
+				}
+				written -= remaining;
+				output_.pop_front();
+				output_offset_ = 0;
+			}
+		}
+
+		if (output_.empty()) {
+			link_.modify(ioready_input);
+		}
+	}
+
+}
@@ -0,0 +1,222 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <stdexcept>
+
+#include <tscb/handoff>
+
+namespace tscb {
+
+	namespace {
+
+		/* SCM_MAX_FD of the kernel */
+		const size_t max_batch_fds = 253;
+		/* bound for the data part of each message */
+		const size_t max_batch_bytes = 65536;
+
+		/*
+			Message layout: number of entries n (0 terminates the
+			handoff), n state lengths, then the states back to back;
+			all integers 32 bit in host byte order. The descriptors
+			travel in the same order as ancillary data.
+		*/
+
+		void
+		append_u32(std::string & buffer, uint32_t value)
+		{
+			buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+		}
+
+		void
+		send_batch(int socket, const std::string & data, const int * fds, size_t nfds)
+		{
+			struct iovec iov;
+			iov.iov_base = const_cast<char *>(data.data());
+			iov.iov_len = data.size();
+
+			union {
+				struct cmsghdr header;
+				char space[CMSG_SPACE(sizeof(int) * max_batch_fds)];
+			} control;
+
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			if (nfds) {
+				msg.msg_control = &control;
+				msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+				struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_RIGHTS;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+				memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+			}
+
+			ssize_t result;
+			do {
+				result = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+			} while (result < 0 && errno == EINTR);
+			if (result != ssize_t(data.size())) {
+				throw std::runtime_error("Unable to send descriptors");
+			}
+		}
+
+		void
+		close_all(const std::vector<handoff_entry> & entries) noexcept
+		{
+			for (const handoff_entry & entry : entries) {
+				::close(entry.fd);
+			}
+		}
+
+	}
+
+	void
+	send_handoff(int socket, const std::vector<handoff_entry> & entries)
+		/*throw(std::bad_alloc, std::invalid_argument, std::runtime_error)*/
+	{
+		for (const handoff_entry & entry : entries) {
+			if (entry.state.size() > handoff_max_state) {
+				throw std::invalid_argument("State too large for handoff");
+			}
+		}
+
+		size_t pos = 0;
+		while (pos < entries.size()) {
+			/* as many entries as fit into one message */
+			size_t count = 0, bytes = sizeof(uint32_t);
+			while (pos + count < entries.size() && count < max_batch_fds) {
+				size_t entry_bytes = sizeof(uint32_t) + entries[pos + count].state.size();
+				if (bytes + entry_bytes > max_batch_bytes) {
+					break;
+				}
+				bytes += entry_bytes;
+				++count;
+			}
+
+			std::string data;
+			data.reserve(bytes);
+			int fds[max_batch_fds];
+			append_u32(data, count);
+			for (size_t n = 0; n < count; ++n) {
+				append_u32(data, entries[pos + n].state.size());
+				fds[n] = entries[pos + n].fd;
+			}
+			for (size_t n = 0; n < count; ++n) {
+				data += entries[pos + n].state;
+			}
+
+			send_batch(socket, data, fds, count);
+			pos += count;
+		}
+
+		std::string end;
+		append_u32(end, 0);
+		send_batch(socket, end, nullptr, 0);
+	}
+
+	std::vector<handoff_entry>
+	receive_handoff(int socket)
+		/*throw(std::bad_alloc, std::runtime_error)*/
+	{
+		std::vector<handoff_entry> entries;
+		std::vector<char> data(max_batch_bytes);
+
+		try {
+			for (;;) {
+				struct iovec iov;
+				iov.iov_base = &data[0];
+				iov.iov_len = data.size();
+
+				union {
+					struct cmsghdr header;
+					char space[CMSG_SPACE(sizeof(int) * max_batch_fds)];
+				} control;
+
+				struct msghdr msg;
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_iov = &iov;
+				msg.msg_iovlen = 1;
+				msg.msg_control = &control;
+				msg.msg_controllen = sizeof(control);
+
+				ssize_t result;
+				do {
+					result = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+				} while (result < 0 && errno == EINTR);
+				if (result <= 0) {
+					throw std::runtime_error("Unable to receive descriptors");
+				}
+
+				/* take ownership of the descriptors first, so they
+				are closed on any error below */
+				std::vector<int> fds;
+				for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+					if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+						size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+						const char * p = reinterpret_cast<const char *>(CMSG_DATA(cmsg));
+						for (size_t k = 0; k < n; ++k) {
+							int fd;
+							memcpy(&fd, p + k * sizeof(int), sizeof(int));
+							fds.push_back(fd);
+						}
+					}
+				}
+				size_t first_new = entries.size();
+				for (int fd : fds) {
+					entries.push_back(handoff_entry{fd, std::string()});
+				}
+
+				if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+					throw std::runtime_error("Truncated handoff message");
+				}
+
+				size_t size = result;
+				uint32_t count;
+				if (size < sizeof(uint32_t)) {
+					throw std::runtime_error("Malformed handoff message");
+				}
+				memcpy(&count, &data[0], sizeof(uint32_t));
+				if (count != fds.size()) {
+					throw std::runtime_error("Malformed handoff message");
+				}
+				if (count == 0) {
+					break;
+				}
+
+				size_t offset = sizeof(uint32_t) * (1 + count);
+				if (offset > size) {
+					throw std::runtime_error("Malformed handoff message");
+				}
+				for (size_t n = 0; n < count; ++n) {
+					uint32_t length;
+					memcpy(&length, &data[sizeof(uint32_t) * (1 + n)], sizeof(uint32_t));
+					if (length > size - offset) {
+						throw std::runtime_error("Malformed handoff message");
+					}
+					entries[first_new + n].state.assign(&data[offset], length);
+					offset += length;
+				}
+			}
+		}
+		catch (...) {
+			close_all(entries);
+			throw;
+		}
+
+		return entries;
+	}
+
+}
@@ -0,0 +1,75 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <tscb/idle-timeout>
+
+namespace tscb {
+
+	idle_timeout::idle_timeout(timer_service & timers, std::chrono::steady_clock::duration timeout,
+		std::function<void(void)> expired) /*throw(std::bad_alloc)*/
+		: timers_(timers), timeout_(timeout), expired_(std::move(expired)), last_activity_(0)
+	{
+		restart();
+	}
+
+	idle_timeout::~idle_timeout(void) noexcept
+	{
+		stop();
+	}
+
+	void
+	idle_timeout::restart(void) /*throw(std::bad_alloc)*/
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		touch(now);
+		timer_.disconnect();
+		timer_ = timers_.timer(std::bind(&idle_timeout::on_timer, this, std::placeholders::_1),
+			now + timeout_);
+	}
+
+	void
+	idle_timeout::stop(void) noexcept
+	{
+		timer_.disconnect();
+	}
+
+	ioready_connection
+	idle_timeout::watch(ioready_service & service, std::function<void(ioready_events)> function,
+		int fd, ioready_events event_mask) /*throw(std::bad_alloc)*/
+	{
+		return service.watch(std::bind(&idle_timeout::on_event, this, std::move(function),
+			std::placeholders::_1), fd, event_mask);
+	}
+
+	bool
+	idle_timeout::on_timer(std::chrono::steady_clock::time_point & now) noexcept
+	{
+		std::chrono::steady_clock::time_point deadline(std::chrono::steady_clock::duration(
+			last_activity_.load(std::memory_order_relaxed)));
+		deadline += timeout_;
+
+		/* activity since the timer was armed: just move the timer
+		to the new deadline */
+		if (deadline > now) {
+			now = deadline;
+			return true;
+		}
+
+		expired_();
+		return false;
+	}
+
+	void
+	idle_timeout::on_event(idle_timeout * self, const std::function<void(ioready_events)> & function,
+		ioready_events events)
+	{
+		self->touch();
+		function(events);
+	}
+
+}
@@ -14,6 +14,7 @@
 #include <sys/epoll.h>
 
 #include <cassert>
+#include <stdexcept>
 
 namespace tscb {
 
@@ -33,9 +34,21 @@ namespace tscb {
 		int e = 0;
 		if (ev & ioready_input) e |= EPOLLIN;
 		if (ev & ioready_output) e |= EPOLLOUT;
+		if (ev & ioready_exclusive) e |= EPOLLEXCLUSIVE;
 		return e;
 	}
 
+	namespace {
+
+		/* whether the descriptor needs to be registered with epoll;
+		the exclusive flag alone does not request any events */
+		inline bool watched(ioready_events mask) noexcept
+		{
+			return (mask & ~ioready_exclusive) != ioready_none;
+		}
+
+	}
+
 	ioready_dispatcher_epoll::ioready_dispatcher_epoll(void)
 		:
 			epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
@@ -215,6 +228,94 @@ namespace tscb {
 		return *flag;
 	}
 
+	void ioready_dispatcher_epoll::after_fork_child(void)
+		/* throw(std::runtime_error, std::bad_alloc) */
+	{
+		async_write_guard<ioready_dispatcher_epoll> guard(*this);
+
+		int fd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (fd < 0) {
+			throw std::runtime_error("Unable to create epoll descriptor");
+		}
+		/* only drops our reference, the parent keeps its instance */
+		::close(epoll_fd_);
+		epoll_fd_ = fd;
+
+		pipe_eventflag * flag = wakeup_flag_.load(std::memory_order_relaxed);
+		if (flag) {
+			flag->recreate();
+		}
+
+		size_t limit = fdtab_.fd_limit();
+		for (size_t n = 0; n < limit; ++n) {
+			ioready_events mask = fdtab_.compute_mask(n);
+			if (!watched(mask)) {
+				continue;
+			}
+			epoll_event event;
+			event.events = translate_tscb_to_os(mask);
+			event.data.u64 = 0;
+			event.data.fd = n;
+			/* descriptors closed between fork and now simply stay
+			silent; their callbacks remain registered */
+			::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, n, &event);
+		}
+	}
+
+	void ioready_dispatcher_epoll::compact(void) noexcept
+	{
+		/* the table is shrunk when the write lock synchronizes, which
+		may be deferred until the last reader leaves */
+		async_write_guard<ioready_dispatcher_epoll> guard(*this);
+		fdtab_.request_compact();
+	}
+
+	std::vector<int> ioready_dispatcher_epoll::registered_descriptors(void)
+		/* throw(std::bad_alloc) */
+	{
+		std::vector<int> fds;
+		async_write_guard<ioready_dispatcher_epoll> guard(*this);
+
+		/* leave out the internal wakeup pipe */
+		pipe_eventflag * flag = wakeup_flag_.load(std::memory_order_relaxed);
+		int wakeup_fd = flag ? flag->readfd_ : -1;
+
+		size_t limit = fdtab_.fd_limit();
+		for (size_t n = 0; n < limit; ++n) {
+			if (int(n) != wakeup_fd && fdtab_.has_callbacks(n)) {
+				fds.push_back(n);
+			}
+		}
+
+		return fds;
+	}
+
+	int ioready_dispatcher_epoll::pollable_fd(void) const noexcept
+	{
+		return epoll_fd_;
+	}
+
+	bool ioready_dispatcher_epoll::prepare_external_wait(void) noexcept
+	{
+		pipe_eventflag * evflag = wakeup_flag_.load(std::memory_order_consume);
+		if (!evflag) {
+			return true;
+		}
+		/* same protocol as dispatch: mark waiting first, so a
+		concurrent trigger either writes to the pipe (making the
+		epoll descriptor readable) or is seen here */
+		evflag->start_waiting();
+		return evflag->flagged_.load(std::memory_order_relaxed) == 0;
+	}
+
+	void ioready_dispatcher_epoll::finish_external_wait(void) noexcept
+	{
+		pipe_eventflag * evflag = wakeup_flag_.load(std::memory_order_consume);
+		if (evflag) {
+			evflag->stop_waiting();
+		}
+	}
+
 	void ioready_dispatcher_epoll::synchronize(void) noexcept
 	{
 		ioready_callback * stale = fdtab_.synchronize();
@@ -233,6 +334,15 @@ namespace tscb {
 	{
 		async_write_guard<ioready_dispatcher_epoll> guard(*this);
 
+		/* EPOLLEXCLUSIVE is fixed when the descriptor is added and
+		rules out any later EPOLL_CTL_MOD, so an exclusive callback
+		cannot share its descriptor with other callbacks */
+		if (fdtab_.has_callbacks(link->fd_) &&
+			((link->event_mask_ & ioready_exclusive) || (fdtab_.compute_mask(link->fd_) & ioready_exclusive))) {
+			delete link;
+			throw std::invalid_argument("Exclusive ioready callback cannot share descriptor");
+		}
+
 		ioready_events old_mask, new_mask;
 
 		try {
@@ -243,14 +353,14 @@ namespace tscb {
 			throw;
 		}
 
-		if (new_mask != ioready_none && old_mask != new_mask) {
+		if (watched(new_mask) && old_mask != new_mask) {
 			epoll_event event;
 			event.events = translate_tscb_to_os(new_mask);
 			event.data.u64 = 0;
 			event.data.fd = link->fd_;
 
 			int op;
-			if (old_mask) {
+			if (watched(old_mask)) {
 				op = EPOLL_CTL_MOD;
 			} else {
 				op = EPOLL_CTL_ADD;
@@ -261,7 +371,7 @@ namespace tscb {
 			}
 		}
 
-		link->service_.store(this, std::memory_order_release);
+		link->set_service(this);
 	}
 
 	void ioready_dispatcher_epoll::unregister_ioready_callback(ioready_callback *link)
@@ -269,17 +379,17 @@ namespace tscb {
 	{
 		async_write_guard<ioready_dispatcher_epoll> guard(*this);
 
-		if (link->service_.load(std::memory_order_acquire)) {
+		if (link->service()) {
 			int fd = link->fd_;
 			ioready_events old_mask, new_mask;
 			fdtab_.remove(link, old_mask, new_mask);
 
-			if (old_mask) {
+			if (watched(old_mask) && old_mask != new_mask) {
 				epoll_event event;
 				event.data.u64 = 0;
 				event.data.fd = fd;
 				int op;
-				if (new_mask) {
+				if (watched(new_mask)) {
 					event.events = translate_tscb_to_os(new_mask);
 					op = EPOLL_CTL_MOD;
 				} else {
@@ -291,10 +401,10 @@ namespace tscb {
 				}
 			}
 
-			link->service_.store(nullptr, std::memory_order_release);
+			link->set_service(nullptr);
 		}
 
-		link->cancellation_mutex_.unlock();
+		link->cancellation_unlock();
 	}
 
 	void ioready_dispatcher_epoll::modify_ioready_callback(ioready_callback *link, ioready_events event_mask)
@@ -312,17 +422,27 @@ namespace tscb {
 			event.data.fd = link->fd_;
 			int op;
 
-			if (old_mask) {
-				if (new_mask) {
+			if (watched(old_mask)) {
+				if (watched(new_mask)) {
 					event.events = translate_tscb_to_os(new_mask);
 					op = EPOLL_CTL_MOD;
+					if (new_mask & ioready_exclusive) {
+						/* exclusive registrations cannot be modified,
+						only replaced */
+						if (::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, link->fd_, &event) != 0) {
+							assert(false && "epoll_ctrl() failed");
+						}
+						op = EPOLL_CTL_ADD;
+					}
 				} else {
 					event.events = translate_tscb_to_os(old_mask);
 					op = EPOLL_CTL_DEL;
 				}
-			} else {
+			} else if (watched(new_mask)) {
 				event.events = translate_tscb_to_os(new_mask);
 				op = EPOLL_CTL_ADD;
+			} else {
+				return;
 			}
 			if (::epoll_ctl(epoll_fd_, op, link->fd_, &event) != 0) {
 				assert(false && "epoll_ctrl() failed");
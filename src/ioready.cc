@@ -7,39 +7,55 @@
  */
 
 #include <string.h>
+
+#include <stdexcept>
+
 #include <tscb/config>
 #include <tscb/ioready>
 #include <tscb/ioready-epoll>
 
 namespace tscb {
 
+	/* folding the cancellation lock into service_ brought callbacks
+	down to 96 bytes on LP64; keep new members from growing them
+	unnoticed */
+	static_assert(sizeof(void *) != 8 || sizeof(ioready_callback) <= 96,
+		"ioready_callback exceeds 96 bytes");
+
 	void ioready_callback::disconnect(void) throw()
 	{
-		cancellation_mutex_.lock();
-		ioready_service * tmp = service_.load(std::memory_order_acquire);
+		cancellation_lock();
+		ioready_service * tmp = service();
 		if (tmp) {
 			tmp->unregister_ioready_callback(this);
 		} else {
-			cancellation_mutex_.unlock();
+			cancellation_unlock();
 		}
 	}
 
 	bool ioready_callback::connected(void) const throw()
 	{
-		return !!service_.load(std::memory_order_acquire);
+		return !!service();
 	}
 
-	void ioready_callback::modify(ioready_events evmask) throw()
+	void ioready_callback::modify(ioready_events evmask) /*throw(std::invalid_argument)*/
 	{
-		if (evmask != ioready_none) {
+		if ((evmask & ~ioready_exclusive) != ioready_none) {
 			evmask = evmask | ioready_error | ioready_hangup;
 		}
-		cancellation_mutex_.lock();
-		ioready_service * tmp = service_.load(std::memory_order_acquire);
+		cancellation_lock();
+		/* event_mask_ is written by the service under this lock */
+		ioready_events exclusive = event_mask_ & ioready_exclusive;
+		if ((evmask & ioready_exclusive) && !exclusive) {
+			cancellation_unlock();
+			throw std::invalid_argument("Cannot make existing ioready callback exclusive");
+		}
+		evmask = evmask | exclusive;
+		ioready_service * tmp = service();
 		if (tmp) {
 			tmp->modify_ioready_callback(this, evmask);
 		}
-		cancellation_mutex_.unlock();
+		cancellation_unlock();
 	}
 
 	ioready_callback::~ioready_callback(void) throw()
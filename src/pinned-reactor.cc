@@ -0,0 +1,118 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <future>
+#include <stdexcept>
+
+#include <tscb/pinned-reactor>
+
+namespace tscb {
+
+	namespace {
+
+		/* work queue nodes kept on the reactor's node */
+		const size_t reserved_workitems = 256;
+
+	}
+
+	pinned_reactor_thread::pinned_reactor_thread(int cpu) /*throw(std::bad_alloc, std::runtime_error)*/
+		: stopping_(false)
+	{
+		placement_.cpu = -1;
+		placement_.node = -1;
+
+		if (cpu < 0 || cpu >= CPU_SETSIZE) {
+			throw std::runtime_error("Invalid cpu number");
+		}
+
+		pipe_eventflag started;
+		std::exception_ptr error;
+		thread_ = std::thread(&pinned_reactor_thread::run, this, cpu, &started, &error);
+		started.wait();
+
+		if (error) {
+			thread_.join();
+			std::rethrow_exception(error);
+		}
+	}
+
+	pinned_reactor_thread::~pinned_reactor_thread(void) noexcept
+	{
+		stopping_.store(true);
+		/* the flag is checked before each dispatch; set the trigger
+		after it, so that the reactor either sees the flag or does not
+		block in its io wait */
+		reactor_->get_eventtrigger().set();
+		thread_.join();
+	}
+
+	timer_connection
+	pinned_reactor_thread::timer(std::function<bool(std::chrono::steady_clock::time_point &)> function,
+		std::chrono::steady_clock::time_point expires) /*throw(std::bad_alloc)*/
+	{
+		if (std::this_thread::get_id() == thread_.get_id()) {
+			return reactor_->timer(std::move(function), expires);
+		}
+
+		std::promise<timer_connection> result;
+		reactor_->post([this, &result, &function, expires]() {
+			try {
+				result.set_value(reactor_->timer(std::move(function), expires));
+			}
+			catch (...) {
+				result.set_exception(std::current_exception());
+			}
+		});
+		return result.get_future().get();
+	}
+
+	void
+	pinned_reactor_thread::run(int cpu, eventflag * started, std::exception_ptr * error) noexcept
+	{
+		try {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (::sched_setaffinity(0, sizeof(set), &set) < 0) {
+				throw std::runtime_error("Unable to bind thread to cpu");
+			}
+
+			unsigned int current_cpu, current_node;
+			if (::syscall(SYS_getcpu, &current_cpu, &current_node, nullptr) == 0) {
+				placement_.cpu = current_cpu;
+				placement_.node = current_node;
+			} else {
+				placement_.cpu = cpu;
+				placement_.node = -1;
+			}
+
+			/* construct on this thread, so the dispatcher state is
+			first touched on the node we are bound to */
+			reactor_.reset(new posix_reactor);
+			reactor_->reserve_workitems(reserved_workitems);
+		}
+		catch (...) {
+			*error = std::current_exception();
+			started->set();
+			return;
+		}
+
+		started->set();
+
+		while (!stopping_.load()) {
+			reactor_->dispatch();
+		}
+
+		reactor_.reset();
+	}
+
+}
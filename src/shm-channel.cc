@@ -0,0 +1,245 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdexcept>
+
+#include <tscb/shm-channel>
+
+namespace tscb {
+
+	namespace {
+
+		/* length word marking the remainder of the ring as unused */
+		const uint32_t wrap_marker = 0xffffffff;
+
+		inline size_t
+		record_size(size_t size) noexcept
+		{
+			return (sizeof(uint32_t) + size + 7) & ~size_t(7);
+		}
+
+	}
+
+	shm_channel::shm_channel(size_t capacity) /*throw(std::bad_alloc, std::runtime_error)*/
+		: memory_fd_(-1), doorbell_fd_(-1), control_(nullptr), data_(nullptr), capacity_(64), failed_(false)
+	{
+		while (capacity_ < capacity) {
+			capacity_ <<= 1;
+		}
+
+		memory_fd_ = ::memfd_create("tscb-shm-channel", MFD_CLOEXEC);
+		if (memory_fd_ < 0) {
+			throw std::runtime_error("Unable to create shared memory file");
+		}
+		if (::ftruncate(memory_fd_, sizeof(control_block) + capacity_) < 0) {
+			::close(memory_fd_);
+			throw std::runtime_error("Unable to size shared memory file");
+		}
+
+		doorbell_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (doorbell_fd_ < 0) {
+			::close(memory_fd_);
+			throw std::runtime_error("Unable to create doorbell");
+		}
+
+		try {
+			map(sizeof(control_block) + capacity_);
+		}
+		catch (...) {
+			::close(memory_fd_);
+			::close(doorbell_fd_);
+			throw;
+		}
+
+		/* fresh file is zero-filled, so both positions are 0 already */
+	}
+
+	shm_channel::shm_channel(int memory_fd, int doorbell_fd) /*throw(std::runtime_error)*/
+		: memory_fd_(memory_fd), doorbell_fd_(doorbell_fd), control_(nullptr), data_(nullptr), capacity_(0), failed_(false)
+	{
+		try {
+			struct stat st;
+			if (::fstat(memory_fd_, &st) < 0) {
+				throw std::runtime_error("Unable to query shared memory file");
+			}
+			size_t size = st.st_size;
+			if (size < sizeof(control_block) + 64) {
+				throw std::runtime_error("Shared memory file too small");
+			}
+			capacity_ = size - sizeof(control_block);
+			if (capacity_ & (capacity_ - 1)) {
+				throw std::runtime_error("Shared memory file has invalid size");
+			}
+			map(size);
+		}
+		catch (...) {
+			::close(memory_fd_);
+			::close(doorbell_fd_);
+			throw;
+		}
+	}
+
+	shm_channel::~shm_channel(void) noexcept
+	{
+		::munmap(control_, sizeof(control_block) + capacity_);
+		::close(memory_fd_);
+		::close(doorbell_fd_);
+	}
+
+	void
+	shm_channel::map(size_t size) /*throw(std::runtime_error)*/
+	{
+		void * addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd_, 0);
+		if (addr == MAP_FAILED) {
+			throw std::runtime_error("Unable to map shared memory file");
+		}
+		control_ = reinterpret_cast<control_block *>(addr);
+		data_ = reinterpret_cast<char *>(addr) + sizeof(control_block);
+	}
+
+	size_t
+	shm_channel::max_message_size(void) const noexcept
+	{
+		/* with records of at most half the ring size, a record that
+		does not fit before the end of the ring always fits at its
+		start once the consumer has caught up */
+		return capacity_ / 2 - sizeof(uint32_t);
+	}
+
+	bool
+	shm_channel::send(const void * data, size_t size) /*throw(std::invalid_argument)*/
+	{
+		if (size > max_message_size()) {
+			throw std::invalid_argument("Message too large for shm_channel");
+		}
+
+		uint64_t head = control_->head_.load(std::memory_order_relaxed);
+		uint64_t tail = control_->tail_.load(std::memory_order_acquire);
+
+		size_t record = record_size(size);
+		size_t pos = head & (capacity_ - 1);
+		size_t contiguous = capacity_ - pos;
+		size_t needed = record <= contiguous ? record : contiguous + record;
+		if (head + needed - tail > capacity_) {
+			return false;
+		}
+
+		uint64_t new_head = head;
+		if (record > contiguous) {
+			memcpy(data_ + pos, &wrap_marker, sizeof(uint32_t));
+			new_head += contiguous;
+			pos = 0;
+		}
+		uint32_t length = size;
+		memcpy(data_ + pos, &length, sizeof(uint32_t));
+		memcpy(data_ + pos + sizeof(uint32_t), data, size);
+		new_head += record;
+
+		control_->head_.store(new_head, std::memory_order_release);
+
+		/* pairs with the fence in drain: either we see that the
+		consumer has caught up with the old head (and ring the
+		doorbell), or the consumer sees the new head */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (control_->tail_.load(std::memory_order_relaxed) == head) {
+			ring_doorbell();
+		}
+
+		return true;
+	}
+
+	void
+	shm_channel::ring_doorbell(void) noexcept
+	{
+		uint64_t value = 1;
+		ssize_t res;
+		do {
+			res = ::write(doorbell_fd_, &value, sizeof(value));
+		} while (res < 0 && errno == EINTR);
+	}
+
+	connection
+	shm_channel::receive(ioready_service & service, handler_type handler) /*throw(std::bad_alloc)*/
+	{
+		connection c = service.watch(
+			std::bind(&shm_channel::drain, this, std::move(handler), std::placeholders::_1),
+			doorbell_fd_, ioready_input);
+		/* messages may have been queued before the consumer attached
+		without a doorbell the watch could observe */
+		ring_doorbell();
+		return c;
+	}
+
+	void
+	shm_channel::drain(const handler_type & handler, ioready_events /*events*/) noexcept
+	{
+		uint64_t value;
+		ssize_t res;
+		do {
+			res = ::read(doorbell_fd_, &value, sizeof(value));
+		} while (res < 0 && errno == EINTR);
+
+		if (failed_) {
+			return;
+		}
+
+		/* positions and records are written by the peer, so check
+		everything before touching the ring */
+		uint64_t tail = control_->tail_.load(std::memory_order_relaxed);
+		if (tail & 7) {
+			failed_ = true;
+			return;
+		}
+		for (;;) {
+			uint64_t head = control_->head_.load(std::memory_order_acquire);
+			if (head - tail > capacity_) {
+				failed_ = true;
+				return;
+			}
+			if (head == tail) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (control_->head_.load(std::memory_order_acquire) == tail) {
+					break;
+				}
+				continue;
+			}
+
+			while (tail != head) {
+				size_t pos = tail & (capacity_ - 1);
+				uint32_t length;
+				memcpy(&length, data_ + pos, sizeof(uint32_t));
+				if (length == wrap_marker) {
+					if (head - tail < capacity_ - pos) {
+						failed_ = true;
+						return;
+					}
+					tail += capacity_ - pos;
+					continue;
+				}
+				if (length > max_message_size() || pos + record_size(length) > capacity_ ||
+					head - tail < record_size(length)) {
+					failed_ = true;
+					return;
+				}
+				handler(data_ + pos + sizeof(uint32_t), length);
+				tail += record_size(length);
+			}
+
+			/* release the whole batch to the producer at once */
+			control_->tail_.store(tail, std::memory_order_release);
+		}
+	}
+
+}
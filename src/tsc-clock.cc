@@ -0,0 +1,168 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TSCB_HAVE_TSC 1
+#endif
+
+#include <atomic>
+
+#include <tscb/dispatch>
+#include <tscb/tsc-clock>
+
+namespace tscb {
+
+	namespace {
+
+		inline int64_t
+		monotonic_ns(void) noexcept
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+			return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+
+		class tsc_calibration {
+		public:
+			tsc_calibration(void) noexcept
+				: use_tsc_(false), tsc0_(0), ns0_(0), mult_(0), drift_ppm_(0)
+			{
+#ifdef TSCB_HAVE_TSC
+				unsigned int eax, ebx, ecx, edx;
+				if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+					return;
+				}
+				/* invariant TSC */
+				if (!(edx & (1 << 8))) {
+					return;
+				}
+
+				/* measure tick rate over a few milliseconds */
+				uint64_t tsc_start = 0, tsc_end = 0;
+				int64_t ns_start = 0, ns_end = 0;
+				uint64_t error = sample(tsc_start, ns_start);
+				uint64_t error_end;
+				do {
+					error_end = sample(tsc_end, ns_end);
+				} while (ns_end - ns_start < 10000000);
+				error += error_end;
+
+				if (tsc_end <= tsc_start) {
+					return;
+				}
+
+				/* nanoseconds per tick in 32.32 fixed point */
+				mult_ = (uint64_t(ns_end - ns_start) << 32) / (tsc_end - tsc_start);
+				tsc0_ = tsc_end;
+				ns0_ = ns_end;
+				/* each reading is uncertain by half its bracket, in
+				either direction */
+				drift_ppm_ = 1e6 * double(error) / double(tsc_end - tsc_start);
+				use_tsc_ = true;
+#endif
+			}
+
+#ifdef TSCB_HAVE_TSC
+			/* read both clocks; use the tightest of several brackets
+			to keep the first (cold) calls and preemption from
+			skewing the calibration; returns the bracket width */
+			static uint64_t
+			sample(uint64_t & tsc, int64_t & ns) noexcept
+			{
+				uint64_t best = ~uint64_t(0);
+				for (int n = 0; n < 16; ++n) {
+					uint64_t before = __rdtsc();
+					int64_t now = monotonic_ns();
+					uint64_t after = __rdtsc();
+					if (after - before < best) {
+						best = after - before;
+						tsc = before + (after - before) / 2;
+						ns = now;
+					}
+				}
+				return best;
+			}
+#endif
+
+			inline int64_t
+			now(void) const noexcept
+			{
+#ifdef TSCB_HAVE_TSC
+				if (__builtin_expect(use_tsc_, true)) {
+					__extension__ typedef __int128 int128;
+					/* signed, so that a counter slightly behind on
+					another core does not wrap around */
+					int64_t delta = int64_t(__rdtsc() - tsc0_);
+					return ns0_ + int64_t((int128(delta) * int128(mult_)) >> 32);
+				}
+#endif
+				return monotonic_ns();
+			}
+
+			bool use_tsc_;
+			uint64_t tsc0_;
+			int64_t ns0_;
+			uint64_t mult_;
+			double drift_ppm_;
+		};
+
+		/* published by calibrate(); null until then */
+		std::atomic<const tsc_calibration *> active_calibration(nullptr);
+
+	}
+
+	tsc_clock::time_point
+	tsc_clock::now(void) noexcept
+	{
+		const tsc_calibration * c = active_calibration.load(std::memory_order_acquire);
+		if (__builtin_expect(!c, false)) {
+			return time_point(duration(monotonic_ns()));
+		}
+		return time_point(duration(c->now()));
+	}
+
+	bool
+	tsc_clock::uses_tsc(void) noexcept
+	{
+		const tsc_calibration * c = active_calibration.load(std::memory_order_acquire);
+		return c && c->use_tsc_;
+	}
+
+	void
+	tsc_clock::calibrate(void) noexcept
+	{
+		static const tsc_calibration instance;
+		active_calibration.store(&instance, std::memory_order_release);
+	}
+
+	double
+	tsc_clock::drift_bound(void) noexcept
+	{
+		const tsc_calibration * c = active_calibration.load(std::memory_order_acquire);
+		return c ? c->drift_ppm_ : 0;
+	}
+
+	void dispatch(tscb::tsc_timerqueue_dispatcher * tq,
+		tscb::ioready_dispatcher * io)
+	{
+		generic_dispatch(tq, io, std::function<void(void)>());
+	}
+
+	void dispatch(tscb::tsc_timerqueue_dispatcher * tq,
+		tscb::ioready_dispatcher * io,
+		const std::function<void(void)> & before_wait)
+	{
+		generic_dispatch(tq, io, before_wait);
+	}
+
+}
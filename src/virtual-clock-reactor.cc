@@ -0,0 +1,105 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <tscb/virtual-clock-reactor>
+
+namespace tscb {
+
+	virtual_clock_reactor::virtual_clock_reactor(std::chrono::steady_clock::time_point start)
+		/*throw(std::bad_alloc)*/
+		: now_(start.time_since_epoch().count())
+	{
+	}
+
+	virtual_clock_reactor::~virtual_clock_reactor(void) noexcept
+	{
+	}
+
+	void
+	virtual_clock_reactor::advance(std::chrono::steady_clock::duration amount)
+	{
+		now_.store((now() + amount).time_since_epoch().count(), std::memory_order_release);
+		run_timers();
+	}
+
+	bool
+	virtual_clock_reactor::run_timers(void)
+	{
+		std::chrono::steady_clock::time_point first_timer_due;
+		if (!timer_dispatcher_.next_timer(first_timer_due)) {
+			return false;
+		}
+
+		std::chrono::steady_clock::time_point t = now();
+		if (first_timer_due > t) {
+			return false;
+		}
+		timer_dispatcher_.run_queue(t);
+		return true;
+	}
+
+	void
+	virtual_clock_reactor::dispatch(void)
+	{
+		if (dispatch_pending()) {
+			return;
+		}
+
+		before_wait_();
+
+		/* idle: jump to the next deadline instead of sleeping */
+		std::chrono::steady_clock::time_point first_timer_due;
+		if (timer_dispatcher_.next_timer(first_timer_due)) {
+			if (first_timer_due > now()) {
+				now_.store(first_timer_due.time_since_epoch().count(), std::memory_order_release);
+			}
+			run_timers();
+			return;
+		}
+
+		io_->dispatch(nullptr);
+	}
+
+	bool
+	virtual_clock_reactor::dispatch_pending(void)
+	{
+		bool processed_events = dispatch_workqueues();
+
+		if (run_timers()) {
+			processed_events = true;
+		}
+
+		if (io_->dispatch_pending()) {
+			processed_events = true;
+		}
+
+		return processed_events;
+	}
+
+	std::chrono::steady_clock::duration
+	virtual_clock_reactor::prepare(void)
+	{
+		before_wait_();
+
+		if (!io_->prepare_external_wait() || !workqueue_.empty()) {
+			return std::chrono::steady_clock::duration::zero();
+		}
+
+		std::chrono::steady_clock::time_point first_timer_due;
+		if (!timer_dispatcher_.next_timer(first_timer_due)) {
+			return std::chrono::steady_clock::duration::max();
+		}
+
+		std::chrono::steady_clock::time_point t = now();
+		if (first_timer_due <= t) {
+			return std::chrono::steady_clock::duration::zero();
+		}
+		return first_timer_due - t;
+	}
+
+}
@@ -0,0 +1,196 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <algorithm>
+#include <memory>
+
+#include <tscb/worker-pool>
+
+namespace tscb {
+
+	worker_pool::worker_pool(size_t nthreads, size_t capacity)
+		: first_(nullptr), last_(nullptr), idle_(nullptr), queued_(0),
+		capacity_(capacity), stopping_(false)
+	{
+		try {
+			for (size_t n = 0; n < nthreads; ++n) {
+				std::unique_ptr<worker> w(new worker);
+				workers_.push_back(w.get());
+				worker * tmp = w.release();
+				tmp->thread_ = std::thread(&worker_pool::run, this, tmp);
+			}
+		}
+		catch (...) {
+			stop();
+			throw;
+		}
+	}
+
+	worker_pool::~worker_pool(void) noexcept
+	{
+		stop();
+	}
+
+	void
+	worker_pool::stop(void) noexcept
+	{
+		std::unique_lock<std::mutex> guard(queue_mutex_);
+		stopping_ = true;
+		worker * idle = idle_;
+		idle_ = nullptr;
+		guard.unlock();
+
+		while (idle) {
+			worker * next = idle->next_idle_;
+			idle->flag_.set();
+			idle = next;
+		}
+
+		for (worker * w : workers_) {
+			if (w->thread_.joinable()) {
+				w->thread_.join();
+			}
+			delete w;
+		}
+		workers_.clear();
+	}
+
+	void
+	worker_pool::post(std::function<void(void)> function) /*throw(std::bad_alloc)*/
+	{
+		workitem * item = new workitem(std::move(function));
+		enqueue(item, item, 1, false);
+	}
+
+	bool
+	worker_pool::try_post(std::function<void(void)> function) /*throw(std::bad_alloc)*/
+	{
+		std::unique_ptr<workitem> item(new workitem(std::move(function)));
+		if (!enqueue(item.get(), item.get(), 1, true)) {
+			return false;
+		}
+		item.release();
+		return true;
+	}
+
+	void
+	worker_pool::post_batch(std::vector<std::function<void(void)> > & functions) /*throw(std::bad_alloc)*/
+	{
+		workitem * first = nullptr, * last = nullptr;
+		size_t count = 0;
+		try {
+			for (std::function<void(void)> & function : functions) {
+				workitem * item = new workitem(std::move(function));
+				if (last) {
+					last->next_ = item;
+				} else {
+					first = item;
+				}
+				last = item;
+				++count;
+			}
+		}
+		catch (std::bad_alloc const&) {
+			while (first) {
+				workitem * next = first->next_;
+				delete first;
+				first = next;
+			}
+			throw;
+		}
+		functions.clear();
+
+		if (first) {
+			enqueue(first, last, count, false);
+		}
+	}
+
+	bool
+	worker_pool::enqueue(workitem * first, workitem * last, size_t count, bool bounded) noexcept
+	{
+		std::unique_lock<std::mutex> guard(queue_mutex_);
+		if (bounded && capacity_ && queued_ + count > capacity_) {
+			return false;
+		}
+		queued_ += count;
+		if (last_) {
+			last_->next_ = first;
+		} else {
+			first_ = first;
+		}
+		last_ = last;
+
+		/* detach as many idle workers as there are new items; they
+		are woken up outside the lock */
+		worker * wake = nullptr;
+		while (idle_ && count) {
+			worker * w = idle_;
+			idle_ = w->next_idle_;
+			w->next_idle_ = wake;
+			wake = w;
+			--count;
+		}
+		guard.unlock();
+
+		while (wake) {
+			worker * next = wake->next_idle_;
+			wake->flag_.set();
+			wake = next;
+		}
+
+		return true;
+	}
+
+	void
+	worker_pool::run(worker * self) noexcept
+	{
+		std::unique_lock<std::mutex> guard(queue_mutex_);
+		for (;;) {
+			workitem * item = first_;
+			if (item) {
+				first_ = item->next_;
+				if (!first_) {
+					last_ = nullptr;
+				}
+				--queued_;
+				guard.unlock();
+
+				item->function_();
+				delete item;
+
+				guard.lock();
+				continue;
+			}
+
+			if (stopping_) {
+				break;
+			}
+
+			/* park on our own flag; it is cleared under the queue lock,
+			so a wakeup issued after we became visible as idle
+			cannot be lost */
+			self->next_idle_ = idle_;
+			idle_ = self;
+			self->flag_.clear();
+			guard.unlock();
+
+			self->flag_.wait();
+
+			guard.lock();
+		}
+	}
+
+	worker_pool &
+	worker_pool::shared(void) /*throw(std::bad_alloc, std::runtime_error)*/
+	{
+		static size_t nthreads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+		static worker_pool pool(nthreads, 64 * nthreads);
+		return pool;
+	}
+
+}
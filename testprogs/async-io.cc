@@ -0,0 +1,266 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <string>
+
+#include <tscb/async-io>
+#include <tscb/dispatch>
+
+static void record(ssize_t * result, int * error, ssize_t r, int e)
+{
+	*result = r;
+	*error = e;
+}
+
+static void make_socketpair(int fds[2])
+{
+	assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0);
+}
+
+void test_read_pending(void)
+{
+	tscb::posix_reactor reactor;
+	int fds[2];
+	make_socketpair(fds);
+
+	char buffer[16];
+	ssize_t result = -2;
+	int error = -1;
+	tscb::connection c = tscb::async_read(reactor, fds[0], buffer, sizeof(buffer),
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+
+	reactor.dispatch_pending_all();
+	assert(result == -2);
+	assert(c.connected());
+
+	assert(::write(fds[1], "hello", 5) == 5);
+	while (result == -2) {
+		reactor.dispatch();
+	}
+	assert(result == 5);
+	assert(error == 0);
+	assert(memcmp(buffer, "hello", 5) == 0);
+	assert(!c.connected());
+
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+void test_read_immediate(void)
+{
+	tscb::posix_reactor reactor;
+	int fds[2];
+	make_socketpair(fds);
+
+	assert(::write(fds[1], "x", 1) == 1);
+
+	char buffer[16];
+	ssize_t result = -2;
+	int error = -1;
+	tscb::connection c = tscb::async_read(reactor, fds[0], buffer, sizeof(buffer),
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+
+	/* completion must not be delivered from within submission */
+	assert(result == -2);
+	reactor.dispatch_pending_all();
+	assert(result == 1);
+	assert(buffer[0] == 'x');
+
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+void test_cancel(void)
+{
+	tscb::posix_reactor reactor;
+	int fds[2];
+	make_socketpair(fds);
+
+	char buffer[16];
+	ssize_t result = -2;
+	int error = -1;
+	tscb::connection c = tscb::async_read(reactor, fds[0], buffer, sizeof(buffer),
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+	c.disconnect();
+
+	assert(::write(fds[1], "x", 1) == 1);
+	reactor.dispatch_pending_all();
+	assert(result == -2);
+
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+void test_write(void)
+{
+	tscb::posix_reactor reactor;
+	int fds[2];
+	make_socketpair(fds);
+
+	static char data[1024 * 1024];
+	memset(data, 'a', sizeof(data));
+
+	ssize_t result = -2;
+	int error = -1;
+	tscb::connection c = tscb::async_write(reactor, fds[1], data, sizeof(data),
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+
+	size_t total = 0;
+	while (result == -2) {
+		char buffer[65536];
+		ssize_t n = ::read(fds[0], buffer, sizeof(buffer));
+		if (n > 0) {
+			total += n;
+		}
+		reactor.dispatch_pending_all();
+	}
+	assert(result == (ssize_t) sizeof(data));
+	assert(error == 0);
+
+	for (;;) {
+		char buffer[65536];
+		ssize_t n = ::read(fds[0], buffer, sizeof(buffer));
+		if (n <= 0) {
+			break;
+		}
+		total += n;
+	}
+	assert(total == sizeof(data));
+
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+static int make_tempfile(const char * data, size_t size)
+{
+	char name[] = "/tmp/tscb-sendfile-XXXXXX";
+	int fd = ::mkstemp(name);
+	assert(fd >= 0);
+	::unlink(name);
+	assert(::write(fd, data, size) == (ssize_t) size);
+	return fd;
+}
+
+void test_sendfile(void)
+{
+	tscb::posix_reactor reactor;
+	int fds[2];
+	make_socketpair(fds);
+
+	static char data[1024 * 1024];
+	for (size_t n = 0; n < sizeof(data); ++n) {
+		data[n] = n * 7;
+	}
+	int file = make_tempfile(data, sizeof(data));
+
+	char head1[] = "HEAD", head2[] = "ER:";
+	char trail[] = ":TRAILER";
+	struct iovec header[2] = {{head1, 4}, {head2, 3}};
+	struct iovec trailer[1] = {{trail, 8}};
+	const size_t offset = 100, length = sizeof(data) - 200;
+
+	ssize_t result = -2;
+	int error = -1;
+	tscb::connection c = tscb::async_sendfile(reactor, fds[1], file, offset, length,
+		header, 2, trailer, 1,
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+
+	std::string received;
+	for (;;) {
+		char buffer[65536];
+		ssize_t n = ::read(fds[0], buffer, sizeof(buffer));
+		if (n > 0) {
+			received.append(buffer, n);
+		} else if (result != -2) {
+			break;
+		}
+		reactor.dispatch_pending_all();
+	}
+	assert(error == 0);
+	assert(result == (ssize_t) (7 + length + 8));
+	assert(received.size() == 7 + length + 8);
+	assert(received.compare(0, 7, "HEADER:") == 0);
+	assert(received.compare(7, length, data + offset, length) == 0);
+	assert(received.compare(7 + length, 8, ":TRAILER") == 0);
+
+	/* file offset untouched */
+	assert(::lseek(file, 0, SEEK_CUR) == (off_t) sizeof(data));
+
+	/* region beyond end of file */
+	result = -2;
+	c = tscb::async_sendfile(reactor, fds[1], file, sizeof(data) - 10, 20,
+		nullptr, 0, trailer, 1,
+		std::bind(record, &result, &error, std::placeholders::_1, std::placeholders::_2));
+	reactor.dispatch_pending_all();
+	assert(result == -1);
+	assert(error == ENODATA);
+
+	::close(file);
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+void test_accept_connect(void)
+{
+	tscb::posix_reactor reactor;
+
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(listener >= 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	/* abstract socket namespace */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "tscb-async-io-%d", (int) getpid());
+	socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+	assert(::bind(listener, reinterpret_cast<struct sockaddr *>(&addr), addrlen) == 0);
+	assert(::listen(listener, 4) == 0);
+
+	ssize_t accepted = -2;
+	int accept_error = -1;
+	tscb::connection a = tscb::async_accept(reactor, listener,
+		std::bind(record, &accepted, &accept_error, std::placeholders::_1, std::placeholders::_2));
+	reactor.dispatch_pending_all();
+	assert(accepted == -2);
+
+	int client = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	ssize_t connected = -2;
+	int connect_error = -1;
+	tscb::connection c = tscb::async_connect(reactor, client,
+		reinterpret_cast<struct sockaddr *>(&addr), addrlen,
+		std::bind(record, &connected, &connect_error, std::placeholders::_1, std::placeholders::_2));
+
+	while (accepted == -2 || connected == -2) {
+		reactor.dispatch();
+	}
+	assert(accepted >= 0);
+	assert(connected == 0);
+
+	::close(accepted);
+	::close(client);
+	::close(listener);
+}
+
+int main()
+{
+	test_read_pending();
+	test_read_immediate();
+	test_cancel();
+	test_write();
+	test_sendfile();
+	test_accept_connect();
+}
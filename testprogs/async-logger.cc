@@ -0,0 +1,185 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tscb/async-logger>
+#include <tscb/dispatch>
+
+static std::string read_all(int fd)
+{
+	std::string contents;
+	char buffer[4096];
+	lseek(fd, 0, SEEK_SET);
+	for (;;) {
+		ssize_t count = read(fd, buffer, sizeof(buffer));
+		if (count <= 0) {
+			break;
+		}
+		contents.append(buffer, count);
+	}
+	return contents;
+}
+
+static int temp_file(void)
+{
+	char path[] = "/tmp/tscb-async-logger-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+	return fd;
+}
+
+void test_threads(void)
+{
+	int fd = temp_file();
+	{
+		tscb::posix_reactor reactor;
+		tscb::async_logger logger(reactor, fd, std::chrono::hours(1), 1 << 20);
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t) {
+			threads.push_back(std::thread([&logger, t]() {
+				for (int n = 0; n < 1000; ++n) {
+					std::ostringstream os;
+					os << t << " " << n << "\n";
+					assert(logger.log(os.str()));
+				}
+			}));
+		}
+		for (std::thread & thread : threads) {
+			thread.join();
+		}
+		logger.log("main\n");
+		/* remaining messages are written on destruction */
+	}
+
+	std::istringstream is(read_all(fd));
+	int next[4] = {0, 0, 0, 0};
+	bool seen_main = false;
+	std::string line;
+	while (std::getline(is, line)) {
+		if (line == "main") {
+			seen_main = true;
+			continue;
+		}
+		int t, n;
+		assert(sscanf(line.c_str(), "%d %d", &t, &n) == 2);
+		assert(t >= 0 && t < 4);
+		/* per-thread order is preserved */
+		assert(n == next[t]);
+		next[t]++;
+	}
+	for (int t = 0; t < 4; ++t) {
+		assert(next[t] == 1000);
+	}
+	assert(seen_main);
+
+	close(fd);
+}
+
+void test_drop(void)
+{
+	int fd = temp_file();
+	tscb::posix_reactor reactor;
+	tscb::async_logger logger(reactor, fd, std::chrono::hours(1), 64);
+
+	std::string big(65, 'x');
+	assert(!logger.log(big));
+	assert(logger.dropped() == 1);
+
+	std::string line(30, 'y');
+	assert(logger.log(line));
+	assert(logger.log(line));
+	assert(!logger.log(line));
+	assert(logger.dropped() == 2);
+
+	logger.flush();
+	assert(read_all(fd) == line + line);
+	assert(logger.log(line));
+
+	close(fd);
+}
+
+void test_drain_triggers(void)
+{
+	int fd = temp_file();
+	tscb::posix_reactor reactor;
+
+	{
+		/* periodic drain */
+		tscb::async_logger logger(reactor, fd, std::chrono::milliseconds(1));
+		logger.log("tick\n");
+		while (read_all(fd).empty()) {
+			reactor.dispatch_pending_all();
+			usleep(1000);
+		}
+		assert(read_all(fd) == "tick\n");
+	}
+
+	{
+		/* drain as soon as a ring becomes half full */
+		tscb::async_logger logger(reactor, fd, std::chrono::hours(1), 128);
+		std::string line(40, 'z');
+		logger.log(line);
+		reactor.dispatch_pending_all();
+		assert(read_all(fd) == "tick\n");
+		logger.log(line);
+		reactor.dispatch_pending_all();
+		assert(read_all(fd) == "tick\n" + line + line);
+	}
+
+	close(fd);
+}
+
+void test_idle_timer(void)
+{
+	int fd = temp_file();
+	tscb::posix_reactor reactor;
+	tscb::async_logger logger(reactor, fd, std::chrono::milliseconds(1));
+
+	/* no timer while nothing is queued */
+	assert(reactor.prepare() == std::chrono::steady_clock::duration::max());
+	reactor.check();
+
+	for (int round = 0; round < 3; ++round) {
+		logger.log("tick\n");
+		reactor.dispatch_pending_all();
+		/* armed by the first message */
+		assert(reactor.prepare() != std::chrono::steady_clock::duration::max());
+		reactor.check();
+
+		while (read_all(fd).size() < 5 * size_t(round + 1)) {
+			reactor.dispatch_pending_all();
+			usleep(1000);
+		}
+		/* disarmed once written */
+		reactor.dispatch_pending_all();
+		assert(reactor.prepare() == std::chrono::steady_clock::duration::max());
+		reactor.check();
+	}
+	assert(read_all(fd) == "tick\ntick\ntick\n");
+
+	close(fd);
+}
+
+int main()
+{
+	test_threads();
+	test_drop();
+	test_drain_triggers();
+	test_idle_timer();
+}
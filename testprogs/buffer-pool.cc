@@ -0,0 +1,161 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <tscb/buffer-pool>
+#include <tscb/dispatch>
+
+void test_pool(void)
+{
+	tscb::buffer_pool pool(2 * tscb::buffer_pool::small_size);
+
+	tscb::pooled_buffer a = pool.acquire(100);
+	assert(a.capacity() == tscb::buffer_pool::small_size);
+	assert(a.size() == 0);
+	char * a_data = a.data();
+
+	tscb::pooled_buffer b = pool.acquire(5000);
+	assert(b.capacity() == tscb::buffer_pool::large_size);
+
+	tscb::pooled_buffer huge = pool.acquire(100000);
+	assert(huge.capacity() == 100000);
+
+	/* released buffers are reused */
+	a.release();
+	assert(!a);
+	assert(pool.cached() == 1);
+	tscb::pooled_buffer c = pool.acquire();
+	assert(c.data() == a_data);
+	assert(pool.cached() == 0);
+
+	/* moving transfers ownership */
+	tscb::pooled_buffer d(std::move(c));
+	assert(!c);
+	assert(d.data() == a_data);
+
+	/* caching is bounded */
+	tscb::pooled_buffer e = pool.acquire();
+	tscb::pooled_buffer f = pool.acquire();
+	d.release();
+	e.release();
+	f.release();
+	assert(pool.cached() == 2);
+
+	/* oversized buffers are not cached */
+	huge.release();
+	assert(pool.cached() == 2);
+
+	pool.trim();
+	assert(pool.cached() == 0);
+}
+
+static void consume(std::string * data, int * eof, tscb::pooled_buffer * keep,
+	tscb::pooled_buffer & buffer, ssize_t result, int /*error*/)
+{
+	if (result == 0) {
+		(*eof)++;
+		return;
+	}
+	assert(result > 0);
+	assert(size_t(result) == buffer.size());
+	data->append(buffer.data(), buffer.size());
+	if (data->size() == 3) {
+		*keep = std::move(buffer);
+	}
+}
+
+void test_pooled_read(void)
+{
+	int pipefd[2];
+	assert(pipe(pipefd) == 0);
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+
+	tscb::posix_reactor reactor;
+	tscb::buffer_pool pool;
+	std::string data;
+	int eof = 0;
+	tscb::pooled_buffer keep;
+	tscb::ioready_connection c = tscb::watch_pooled_read(reactor, pool, pipefd[0],
+		std::bind(consume, &data, &eof, &keep,
+			std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+	/* no buffer is taken while idle */
+	reactor.dispatch_pending_all();
+	assert(pool.cached() == 0);
+
+	assert(write(pipefd[1], "ab", 2) == 2);
+	reactor.dispatch_pending_all();
+	assert(data == "ab");
+	/* buffer went back to the pool after the handler */
+	assert(pool.cached() == 1);
+
+	assert(write(pipefd[1], "c", 1) == 1);
+	reactor.dispatch_pending_all();
+	assert(data == "abc");
+	/* handler kept this one */
+	assert(pool.cached() == 0);
+	assert(keep.size() == 1 && keep.data()[0] == 'c');
+	keep.release();
+	assert(pool.cached() == 1);
+
+	/* end of file stays readable, so do not dispatch until idle */
+	close(pipefd[1]);
+	reactor.dispatch_pending();
+	assert(eof == 1);
+	c.disconnect();
+
+	close(pipefd[0]);
+}
+
+void test_owner_thread(void)
+{
+	tscb::buffer_pool pool(std::this_thread::get_id(), 4 * tscb::buffer_pool::small_size);
+
+	tscb::pooled_buffer a = pool.acquire();
+	char * a_data = a.data();
+	a.release();
+	assert(pool.cached() == 1);
+	tscb::pooled_buffer b = pool.acquire();
+	assert(b.data() == a_data);
+
+	/* buffers released elsewhere come back once the local list is
+	empty */
+	std::vector<tscb::pooled_buffer> others;
+	for (int n = 0; n < 6; ++n) {
+		others.push_back(pool.acquire());
+	}
+	std::thread thread([&others]() { others.clear(); });
+	thread.join();
+	assert(pool.cached() == 0);
+
+	tscb::pooled_buffer c = pool.acquire();
+	/* collected up to the limit, one of them handed out */
+	assert(pool.cached() == 3);
+
+	b.release();
+	c.release();
+	assert(pool.cached() == 4);
+	pool.trim();
+	assert(pool.cached() == 0);
+}
+
+int main()
+{
+	test_pool();
+	test_owner_thread();
+	test_pooled_read();
+}
@@ -0,0 +1,264 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <tscb/cpu-steering-acceptor>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+static std::vector<std::unique_ptr<tscb::pinned_reactor_thread> >
+start_threads(size_t max)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	assert(::sched_getaffinity(0, sizeof(set), &set) == 0);
+
+	std::vector<std::unique_ptr<tscb::pinned_reactor_thread> > threads;
+	for (int cpu = 0; cpu < CPU_SETSIZE && threads.size() < max; ++cpu) {
+		if (CPU_ISSET(cpu, &set)) {
+			threads.emplace_back(new tscb::pinned_reactor_thread(cpu));
+		}
+	}
+	assert(!threads.empty());
+	return threads;
+}
+
+static std::vector<tscb::pinned_reactor_thread *>
+pointers(const std::vector<std::unique_ptr<tscb::pinned_reactor_thread> > & threads)
+{
+	std::vector<tscb::pinned_reactor_thread *> result;
+	for (const std::unique_ptr<tscb::pinned_reactor_thread> & thread : threads) {
+		result.push_back(thread.get());
+	}
+	return result;
+}
+
+/* dispatch until all connections have been handed over */
+static void
+drive(tscb::posix_reactor & reactor, std::atomic<int> & handled, int expected)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (handled.load() < expected) {
+		assert(std::chrono::steady_clock::now() < deadline);
+		reactor.dispatch_pending_all();
+		std::this_thread::yield();
+	}
+}
+
+void test_tcp(void)
+{
+	/* one thread per allowed cpu, so each incoming cpu has its reactor */
+	std::vector<std::unique_ptr<tscb::pinned_reactor_thread> > threads = start_threads(CPU_SETSIZE);
+	tscb::posix_reactor reactor;
+
+	int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(listener >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(::bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+	socklen_t len = sizeof(addr);
+	assert(::getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &len) == 0);
+	assert(::listen(listener, 64) == 0);
+
+	std::atomic<int> handled(0), local(0), known_cpu(0);
+	std::vector<int> clients;
+	{
+		tscb::cpu_steering_acceptor acceptor(reactor, listener, pointers(threads),
+			[&](int fd, tscb::posix_reactor &)
+			{
+				int cpu = -1;
+				socklen_t len = sizeof(cpu);
+				if (::getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0) {
+					++known_cpu;
+					if (cpu == ::sched_getcpu()) {
+						++local;
+					}
+				}
+				::close(fd);
+				++handled;
+			});
+
+		const int count = 16;
+		for (int n = 0; n < count; ++n) {
+			int s = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			assert(::connect(s, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+			clients.push_back(s);
+		}
+
+		drive(reactor, handled, count);
+		assert(acceptor.steered() + acceptor.unsteered() == size_t(count));
+		if (known_cpu.load() == count) {
+			/* kernel reports the incoming cpu, and there is a reactor for each cpu */
+			assert(acceptor.steered() == size_t(count));
+			assert(local.load() > 0);
+		}
+	}
+
+	for (int s : clients) {
+		::close(s);
+	}
+	::close(listener);
+}
+
+void test_round_robin(void)
+{
+	std::vector<std::unique_ptr<tscb::pinned_reactor_thread> > threads = start_threads(2);
+	tscb::posix_reactor reactor;
+
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(listener >= 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	/* abstract namespace */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "tscb-steering-%d", (int) ::getpid());
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+	assert(::bind(listener, reinterpret_cast<struct sockaddr *>(&addr), addr_len) == 0);
+	assert(::listen(listener, 64) == 0);
+
+	std::mutex lock;
+	std::vector<tscb::posix_reactor *> assigned;
+	std::atomic<int> handled(0);
+	std::vector<int> clients;
+	{
+		tscb::cpu_steering_acceptor acceptor(reactor, listener, pointers(threads),
+			[&](int fd, tscb::posix_reactor & r)
+			{
+				::close(fd);
+				std::unique_lock<std::mutex> guard(lock);
+				assigned.push_back(&r);
+				++handled;
+			});
+
+		const int count = 8;
+		for (int n = 0; n < count; ++n) {
+			int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			assert(::connect(s, reinterpret_cast<struct sockaddr *>(&addr), addr_len) == 0);
+			clients.push_back(s);
+		}
+
+		drive(reactor, handled, count);
+		assert(acceptor.steered() == 0);
+		assert(acceptor.unsteered() == size_t(count));
+		for (const std::unique_ptr<tscb::pinned_reactor_thread> & thread : threads) {
+			size_t n = 0;
+			for (tscb::posix_reactor * r : assigned) {
+				n += (r == &thread->reactor());
+			}
+			assert(n == count / threads.size());
+		}
+	}
+
+	for (int s : clients) {
+		::close(s);
+	}
+	::close(listener);
+}
+
+void test_descriptor_shortage(void)
+{
+	std::vector<std::unique_ptr<tscb::pinned_reactor_thread> > threads = start_threads(1);
+	tscb::posix_reactor reactor;
+
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(listener >= 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "tscb-steering-emfile-%d", (int) ::getpid());
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+	assert(::bind(listener, reinterpret_cast<struct sockaddr *>(&addr), addr_len) == 0);
+	assert(::listen(listener, 64) == 0);
+
+	std::atomic<int> handled(0);
+	{
+		tscb::cpu_steering_acceptor acceptor(reactor, listener, pointers(threads),
+			[&](int fd, tscb::posix_reactor &)
+			{
+				::close(fd);
+				++handled;
+			});
+
+		int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		assert(::connect(s, reinterpret_cast<struct sockaddr *>(&addr), addr_len) == 0);
+
+		/* lowest free descriptor becomes the limit: accept fails
+		with EMFILE */
+		struct rlimit saved, limit;
+		assert(::getrlimit(RLIMIT_NOFILE, &saved) == 0);
+		int lowest = ::dup(0);
+		assert(lowest >= 0);
+		::close(lowest);
+		limit = saved;
+		limit.rlim_cur = lowest;
+		assert(::setrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+		/* must not keep retrying while the connection is pending */
+		reactor.dispatch_pending_all();
+		assert(acceptor.steered() + acceptor.unsteered() == 0);
+
+		/* not retried before the backoff expires, even though
+		descriptors are available again */
+		assert(::setrlimit(RLIMIT_NOFILE, &saved) == 0);
+		reactor.dispatch_pending_all();
+		assert(acceptor.steered() + acceptor.unsteered() == 0);
+
+		drive(reactor, handled, 1);
+		assert(acceptor.unsteered() == 1);
+
+		::close(s);
+	}
+
+	::close(listener);
+}
+
+void test_no_threads(void)
+{
+	tscb::posix_reactor reactor;
+	bool caught = false;
+	try {
+		tscb::cpu_steering_acceptor acceptor(reactor, 0, std::vector<tscb::pinned_reactor_thread *>(),
+			[](int, tscb::posix_reactor &) {});
+	}
+	catch (std::invalid_argument &) {
+		caught = true;
+	}
+	assert(caught);
+}
+
+int main(void)
+{
+	test_tcp();
+	test_round_robin();
+	test_descriptor_shortage();
+	test_no_threads();
+	return 0;
+}
@@ -0,0 +1,235 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+#include <tscb/dispatch>
+#include <tscb/file-io>
+
+static void record(ssize_t * result, int * error, int * count, ssize_t r, int e)
+{
+	*result = r;
+	*error = e;
+	(*count) ++;
+}
+
+/* completions arrive from other threads; posix_reactor::dispatch
+may block in the io wait after having run the completion item, so
+poll instead */
+static void wait_for(tscb::posix_reactor & reactor, const int & count, int expected)
+{
+	for (;;) {
+		reactor.dispatch_pending_all();
+		if (count >= expected) {
+			break;
+		}
+		usleep(1000);
+	}
+}
+
+void test_worker_pool(void)
+{
+	std::atomic<int> count(0);
+	{
+		tscb::worker_pool pool(3);
+		std::vector<std::function<void(void)> > batch;
+		for (int n = 0; n < 100; ++n) {
+			batch.push_back([&count]() {count.fetch_add(1, std::memory_order_relaxed);});
+		}
+		pool.post_batch(batch);
+		assert(batch.empty());
+		pool.post([&count]() {count.fetch_add(1, std::memory_order_relaxed);});
+		/* destructor processes all queued items */
+	}
+	assert(count.load() == 101);
+}
+
+void test_read_write(void)
+{
+	char path[] = "/tmp/tscb-file-io-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+
+	tscb::posix_reactor reactor;
+	tscb::worker_pool pool(2);
+	tscb::file_io_service file_io(reactor, pool);
+
+	ssize_t write_result = -2, read_result = -2, sync_result = -2;
+	int write_error = -1, read_error = -1, sync_error = -1;
+	int count = 0;
+
+	file_io.pwrite(fd, "hello world", 11, 0,
+		std::bind(record, &write_result, &write_error, &count, std::placeholders::_1, std::placeholders::_2));
+	file_io.fsync(fd,
+		std::bind(record, &sync_result, &sync_error, &count, std::placeholders::_1, std::placeholders::_2));
+	wait_for(reactor, count, 2);
+	assert(write_result == 11 && write_error == 0);
+	assert(sync_result == 0 && sync_error == 0);
+
+	char buffer[16];
+	file_io.pread(fd, buffer, 5, 6,
+		std::bind(record, &read_result, &read_error, &count, std::placeholders::_1, std::placeholders::_2));
+	/* never completes from within submission */
+	assert(count == 2);
+	wait_for(reactor, count, 3);
+	assert(read_result == 5 && read_error == 0);
+	assert(memcmp(buffer, "world", 5) == 0);
+
+	/* errors are reported through completion */
+	file_io.pread(-1, buffer, 5, 0,
+		std::bind(record, &read_result, &read_error, &count, std::placeholders::_1, std::placeholders::_2));
+	wait_for(reactor, count, 4);
+	assert(read_result == -1 && read_error == EBADF);
+
+	close(fd);
+}
+
+void test_destroy_outstanding(void)
+{
+	char path[] = "/tmp/tscb-file-io-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+	assert(write(fd, "hello world", 11) == 11);
+
+	tscb::worker_pool pool(1);
+	/* occupy the only worker, so the request below stays in flight */
+	std::atomic<bool> release(false), busy(false);
+	pool.post([&release, &busy]() {
+		busy = true;
+		while (!release) {
+			usleep(1000);
+		}
+	});
+	while (!busy) {
+		usleep(1000);
+	}
+
+	std::unique_ptr<tscb::posix_reactor> reactor(new tscb::posix_reactor);
+	std::unique_ptr<tscb::file_io_service> file_io(new tscb::file_io_service(*reactor, pool));
+
+	char buffer[16];
+	memset(buffer, 0, sizeof(buffer));
+	ssize_t result = -2;
+	int error = -1, count = 0;
+	file_io->pread(fd, buffer, 5, 6,
+		std::bind(record, &result, &error, &count, std::placeholders::_1, std::placeholders::_2));
+	/* hand the request to the pool */
+	reactor->dispatch_pending_all();
+
+	file_io.reset();
+	reactor.reset();
+	release = true;
+	/* worker runs the request after service and reactor are gone;
+	single worker, so the marker runs after it */
+	std::atomic<bool> done(false);
+	pool.post([&done]() { done = true; });
+	while (!done) {
+		usleep(1000);
+	}
+
+	assert(count == 0);
+	assert(buffer[0] == 0);
+
+	close(fd);
+}
+
+/* completion queue refusing the first few posts */
+class flaky_queue : public tscb::workqueue_service {
+public:
+	flaky_queue(tscb::posix_reactor & reactor, int failures)
+		: reactor_(reactor), failures_(failures)
+	{
+	}
+
+	virtual void post(std::function<void(void)> function)
+	{
+		if (failures_ > 0) {
+			--failures_;
+			throw std::bad_alloc();
+		}
+		reactor_.post(std::move(function));
+	}
+
+	tscb::posix_reactor & reactor_;
+	int failures_;
+};
+
+void test_failures(void)
+{
+	char path[] = "/tmp/tscb-file-io-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+	assert(write(fd, "hello world", 11) == 11);
+
+	tscb::posix_reactor reactor;
+	tscb::worker_pool pool(1);
+	flaky_queue queue(reactor, 1);
+	tscb::file_io_service file_io(queue, pool);
+
+	char buffer[16];
+	ssize_t result = -2;
+	int error = -1, count = 0;
+
+	/* failure to schedule the flush is reported to the caller... */
+	bool caught = false;
+	try {
+		file_io.pread(fd, buffer, 5, 0,
+			std::bind(record, &result, &error, &count, std::placeholders::_1, std::placeholders::_2));
+	}
+	catch (std::bad_alloc const&) {
+		caught = true;
+	}
+	assert(caught);
+
+	/* ...and does not keep later requests from being processed */
+	file_io.pread(fd, buffer, 5, 6,
+		std::bind(record, &result, &error, &count, std::placeholders::_1, std::placeholders::_2));
+	wait_for(reactor, count, 1);
+	assert(result == 5 && error == 0);
+	assert(memcmp(buffer, "world", 5) == 0);
+
+	/* a throwing completion does not lose the ones after it */
+	file_io.pread(fd, buffer, 5, 0,
+		[](ssize_t, int) { throw std::runtime_error("completion failed"); });
+	file_io.pread(fd, buffer, 5, 0,
+		std::bind(record, &result, &error, &count, std::placeholders::_1, std::placeholders::_2));
+	reactor.dispatch_pending_all();
+	/* give both requests time to complete, so they are delivered
+	in one batch */
+	usleep(50000);
+	caught = false;
+	try {
+		reactor.dispatch_pending_all();
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+	wait_for(reactor, count, 2);
+
+	close(fd);
+}
+
+int main()
+{
+	test_worker_pool();
+	test_read_write();
+	test_destroy_outstanding();
+	test_failures();
+}
@@ -0,0 +1,174 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tscb/dispatch>
+#include <tscb/file-watch-monitor>
+
+struct recorder {
+	std::vector<uint32_t> events;
+	std::vector<std::string> names;
+
+	void record(uint32_t mask, const char * name)
+	{
+		events.push_back(mask);
+		names.push_back(name);
+	}
+};
+
+static void touch(const std::string & path)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+	assert(fd >= 0);
+	assert(write(fd, "x", 1) == 1);
+	close(fd);
+}
+
+void test_file_watch(void)
+{
+	char dir_template[] = "/tmp/tscb-file-watch-XXXXXX";
+	std::string dir = mkdtemp(dir_template);
+	std::string file = dir + "/config";
+	touch(file);
+
+	tscb::posix_reactor reactor;
+	tscb::file_watch_monitor monitor(reactor);
+
+	recorder file_events, file_events2, dir_events;
+	tscb::connection c1 = monitor.watch_file(
+		std::bind(&recorder::record, &file_events, std::placeholders::_1, std::placeholders::_2),
+		file, IN_MODIFY);
+	tscb::connection c2 = monitor.watch_file(
+		std::bind(&recorder::record, &file_events2, std::placeholders::_1, std::placeholders::_2),
+		file, IN_MODIFY);
+	tscb::connection c3 = monitor.watch_file(
+		std::bind(&recorder::record, &dir_events, std::placeholders::_1, std::placeholders::_2),
+		dir, IN_CREATE);
+
+	/* modification of file */
+	touch(file);
+	reactor.dispatch_pending_all();
+	assert(file_events.events.size() == 1);
+	assert(file_events.events[0] & IN_MODIFY);
+	assert(file_events.names[0] == "");
+	assert(file_events2.events.size() == 1);
+	assert(dir_events.events.empty());
+
+	/* creation of directory entry */
+	touch(dir + "/new");
+	reactor.dispatch_pending_all();
+	assert(dir_events.events.size() == 1);
+	assert(dir_events.events[0] & IN_CREATE);
+	assert(dir_events.names[0] == "new");
+
+	/* the shared watch stays in place for the remaining callback */
+	c2.disconnect();
+	touch(file);
+	reactor.dispatch_pending_all();
+	assert(file_events.events.size() == 2);
+	assert(file_events2.events.size() == 1);
+
+	/* deletion removes the watch and disconnects the callback */
+	unlink(file.c_str());
+	reactor.dispatch_pending_all();
+	assert(file_events.events.back() & IN_IGNORED);
+	assert(!c1.connected());
+	assert(c3.connected());
+
+	bool caught = false;
+	try {
+		monitor.watch_file([](uint32_t, const char *) {}, dir + "/missing", IN_MODIFY);
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+
+	c3.disconnect();
+	unlink((dir + "/new").c_str());
+	rmdir(dir.c_str());
+}
+
+/* union of the masks the kernel holds for all inotify watches of
+this process */
+static uint32_t kernel_watch_mask(void)
+{
+	uint32_t mask = 0;
+	DIR * dir = opendir("/proc/self/fdinfo");
+	assert(dir);
+	while (struct dirent * entry = readdir(dir)) {
+		FILE * f = fopen((std::string("/proc/self/fdinfo/") + entry->d_name).c_str(), "r");
+		if (!f) {
+			continue;
+		}
+		char line[512];
+		while (fgets(line, sizeof(line), f)) {
+			unsigned int m;
+			const char * pos = strstr(line, " mask:");
+			if (strncmp(line, "inotify ", 8) == 0 && pos && sscanf(pos, " mask:%x", &m) == 1) {
+				mask |= m;
+			}
+		}
+		fclose(f);
+	}
+	closedir(dir);
+	return mask & IN_ALL_EVENTS;
+}
+
+void test_narrow_mask(void)
+{
+	char dir_template[] = "/tmp/tscb-file-watch-XXXXXX";
+	std::string dir = mkdtemp(dir_template);
+	std::string file = dir + "/config";
+	touch(file);
+
+	tscb::posix_reactor reactor;
+	tscb::file_watch_monitor monitor(reactor);
+
+	recorder events1, events2;
+	tscb::connection c1 = monitor.watch_file(
+		std::bind(&recorder::record, &events1, std::placeholders::_1, std::placeholders::_2),
+		file, IN_MODIFY);
+	tscb::connection c2 = monitor.watch_file(
+		std::bind(&recorder::record, &events2, std::placeholders::_1, std::placeholders::_2),
+		file, IN_ATTRIB);
+	assert(kernel_watch_mask() == (IN_MODIFY | IN_ATTRIB));
+
+	/* mask shrinks to what the remaining callback is interested in */
+	c2.disconnect();
+	assert(kernel_watch_mask() == IN_MODIFY);
+
+	touch(file);
+	reactor.dispatch_pending_all();
+	assert(events1.events.size() == 1);
+	assert(events2.events.empty());
+
+	c1.disconnect();
+	assert(kernel_watch_mask() == 0);
+
+	unlink(file.c_str());
+	rmdir(dir.c_str());
+}
+
+int main()
+{
+	test_file_watch();
+	test_narrow_mask();
+}
@@ -0,0 +1,227 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <tscb/dispatch>
+#include <tscb/framed-channel>
+
+static void collect(std::vector<std::string> * frames, bool * wrapped,
+	const tscb::framed_channel::frame & f)
+{
+	std::string s(f.size(), 0);
+	f.copy_to(&s[0]);
+	frames->push_back(s);
+	if (!f.contiguous()) {
+		*wrapped = true;
+	}
+}
+
+static void record_close(int * error, int e)
+{
+	*error = e;
+}
+
+static void make_socketpair(int fds[2])
+{
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+static void write_frame(int fd, const std::string & s)
+{
+	uint32_t length = htonl(s.size());
+	std::string buffer(reinterpret_cast<const char *>(&length), sizeof(length));
+	buffer += s;
+	assert(write(fd, buffer.data(), buffer.size()) == ssize_t(buffer.size()));
+}
+
+void test_receive(void)
+{
+	int fds[2];
+	make_socketpair(fds);
+
+	tscb::posix_reactor reactor;
+	std::vector<std::string> frames;
+	bool wrapped = false;
+	int error = -1;
+	tscb::framed_channel channel(reactor, fds[0],
+		std::bind(collect, &frames, &wrapped, std::placeholders::_1),
+		std::bind(record_close, &error, std::placeholders::_1),
+		64);
+
+	/* several frames per read, a frame split across reads */
+	write_frame(fds[1], "hello");
+	write_frame(fds[1], "");
+	uint32_t length = htonl(5);
+	assert(write(fds[1], &length, sizeof(length)) == sizeof(length));
+	assert(write(fds[1], "wor", 3) == 3);
+	reactor.dispatch_pending_all();
+	assert(frames.size() == 2);
+	assert(frames[0] == "hello");
+	assert(frames[1] == "");
+
+	assert(write(fds[1], "ld", 2) == 2);
+	reactor.dispatch_pending_all();
+	assert(frames.size() == 3);
+	assert(frames[2] == "world");
+
+	/* keep a partial frame in the ring so that later frames
+	eventually wrap around its end */
+	frames.clear();
+	std::string partial(40, 'p');
+	length = htonl(partial.size());
+	assert(write(fds[1], &length, sizeof(length)) == sizeof(length));
+	assert(write(fds[1], partial.data(), 10) == 10);
+	reactor.dispatch_pending_all();
+	assert(write(fds[1], partial.data() + 10, 30) == 30);
+	write_frame(fds[1], std::string(30, 'x'));
+	for (int n = 0; n < 10; ++n) {
+		reactor.dispatch_pending_all();
+		write_frame(fds[1], std::string(20 + n, 'a' + n));
+	}
+	reactor.dispatch_pending_all();
+	assert(frames.size() == 12);
+	assert(frames[0] == partial);
+	assert(frames[1] == std::string(30, 'x'));
+	for (int n = 0; n < 10; ++n) {
+		assert(frames[2 + n] == std::string(20 + n, 'a' + n));
+	}
+	assert(wrapped);
+
+	/* peer closes */
+	assert(error == -1);
+	close(fds[1]);
+	reactor.dispatch_pending_all();
+	assert(error == 0);
+	assert(!channel.is_open());
+	assert(!channel.send("x", 1));
+
+	close(fds[0]);
+}
+
+void test_oversized(void)
+{
+	int fds[2];
+	make_socketpair(fds);
+
+	tscb::posix_reactor reactor;
+	std::vector<std::string> frames;
+	bool wrapped = false;
+	int error = -1;
+	tscb::framed_channel channel(reactor, fds[0],
+		std::bind(collect, &frames, &wrapped, std::placeholders::_1),
+		std::bind(record_close, &error, std::placeholders::_1),
+		64);
+
+	uint32_t length = htonl(channel.max_frame_size() + 1);
+	assert(write(fds[1], &length, sizeof(length)) == sizeof(length));
+	reactor.dispatch_pending_all();
+	assert(error == EMSGSIZE);
+	assert(frames.empty());
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void test_send(void)
+{
+	int fds[2];
+	make_socketpair(fds);
+
+	tscb::posix_reactor reactor;
+	int error = -1;
+	tscb::framed_channel channel(reactor, fds[0],
+		[](const tscb::framed_channel::frame &) {},
+		std::bind(record_close, &error, std::placeholders::_1));
+
+	assert(channel.send("abc", 3));
+	assert(channel.send("", 0));
+	assert(channel.send("defg", 4));
+	assert(channel.pending_output() == 3 * 4 + 7);
+
+	/* queued frames leave in one batch */
+	reactor.dispatch_pending_all();
+	assert(channel.pending_output() == 0);
+
+	char buffer[64];
+	ssize_t count = read(fds[1], buffer, sizeof(buffer));
+	assert(count == 3 * 4 + 7);
+	uint32_t length;
+	memcpy(&length, buffer, 4);
+	assert(ntohl(length) == 3);
+	assert(memcmp(buffer + 4, "abc", 3) == 0);
+	memcpy(&length, buffer + 7, 4);
+	assert(ntohl(length) == 0);
+	memcpy(&length, buffer + 11, 4);
+	assert(ntohl(length) == 4);
+	assert(memcmp(buffer + 15, "defg", 4) == 0);
+
+	/* round trip between two channels */
+	std::vector<std::string> frames;
+	bool wrapped = false;
+	int peer_error = -1;
+	tscb::framed_channel peer(reactor, fds[1],
+		std::bind(collect, &frames, &wrapped, std::placeholders::_1),
+		std::bind(record_close, &peer_error, std::placeholders::_1),
+		262144);
+	std::string large(200000, 'l');
+	assert(channel.send(large.data(), large.size()) == true);
+	while (frames.empty()) {
+		reactor.dispatch_pending_all();
+	}
+	assert(frames.size() == 1);
+	assert(frames[0] == large);
+
+	/* buffers handed over are queued without copying */
+	std::vector<char> owned(large.begin(), large.end());
+	assert(channel.send(std::move(owned)));
+	assert(owned.empty());
+	/* more frames than segments gathered by one writev */
+	for (int n = 0; n < 100; ++n) {
+		std::string s(n, 'a' + n % 26);
+		assert(channel.send(s.data(), s.size()));
+	}
+	while (frames.size() < 102) {
+		reactor.dispatch_pending_all();
+	}
+	assert(frames[1] == large);
+	for (int n = 0; n < 100; ++n) {
+		assert(frames[n + 2] == std::string(n, 'a' + n % 26));
+	}
+	assert(peer_error == -1);
+	assert(error == -1);
+
+	/* refused after close, buffer left to the caller */
+	channel.close();
+	std::vector<char> kept(3, 'k');
+	assert(!channel.send(std::move(kept)));
+	assert(kept.size() == 3);
+
+	peer.close();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	test_receive();
+	test_oversized();
+	test_send();
+}
@@ -0,0 +1,121 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tscb/dispatch>
+#include <tscb/handoff>
+
+void test_handoff(void)
+{
+	int sock[2];
+	assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock) == 0);
+
+	/* more descriptors than fit into a single message */
+	const int count = 300;
+	std::map<int, int> write_end;
+	std::vector<tscb::ioready_connection> links;
+	tscb::posix_reactor old_reactor;
+	for (int n = 0; n < count; ++n) {
+		int pipefd[2];
+		assert(pipe(pipefd) == 0);
+		write_end[pipefd[0]] = pipefd[1];
+		links.push_back(old_reactor.watch([](tscb::ioready_events) {}, pipefd[0], tscb::ioready_input));
+	}
+	/* a registration without events of interest still counts */
+	links.back().modify(tscb::ioready_none);
+
+	std::vector<int> registered = old_reactor.registered_descriptors();
+	assert(registered.size() == size_t(count));
+	for (int fd : registered) {
+		assert(write_end.find(fd) != write_end.end());
+	}
+
+	std::vector<tscb::handoff_entry> entries;
+	for (int fd : registered) {
+		std::ostringstream os;
+		os << "conn " << fd;
+		entries.push_back(tscb::handoff_entry{fd, os.str()});
+	}
+	/* empty state is fine as well */
+	entries.back().state.clear();
+	tscb::send_handoff(sock[0], entries);
+
+	std::vector<tscb::handoff_entry> received = tscb::receive_handoff(sock[1]);
+	assert(received.size() == entries.size());
+
+	/* stop dispatching in the old "process" */
+	for (tscb::ioready_connection & link : links) {
+		link.disconnect();
+	}
+
+	tscb::posix_reactor new_reactor;
+	int events = 0;
+	for (size_t n = 0; n < received.size(); ++n) {
+		assert(received[n].state == entries[n].state);
+		assert(received[n].fd != entries[n].fd);
+		assert(fcntl(received[n].fd, F_GETFD) & FD_CLOEXEC);
+		links.push_back(new_reactor.watch([&events](tscb::ioready_events) { events++; },
+			received[n].fd, tscb::ioready_input));
+	}
+
+	/* received descriptors refer to the same pipes */
+	assert(write(write_end[entries[5].fd], "x", 1) == 1);
+	new_reactor.dispatch_pending();
+	assert(events == 1);
+	char c;
+	assert(read(received[5].fd, &c, 1) == 1 && c == 'x');
+
+	for (tscb::ioready_connection & link : links) {
+		link.disconnect();
+	}
+	for (size_t n = 0; n < received.size(); ++n) {
+		close(received[n].fd);
+		close(entries[n].fd);
+		close(write_end[entries[n].fd]);
+	}
+
+	/* oversized state is rejected before anything is sent */
+	bool caught = false;
+	try {
+		std::vector<tscb::handoff_entry> bad;
+		bad.push_back(tscb::handoff_entry{sock[0], std::string(tscb::handoff_max_state + 1, 's')});
+		tscb::send_handoff(sock[0], bad);
+	}
+	catch (std::invalid_argument const&) {
+		caught = true;
+	}
+	assert(caught);
+
+	/* peer going away mid-handoff is reported */
+	close(sock[0]);
+	caught = false;
+	try {
+		tscb::receive_handoff(sock[1]);
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+	close(sock[1]);
+}
+
+int main()
+{
+	test_handoff();
+}
@@ -0,0 +1,91 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <tscb/dispatch>
+#include <tscb/idle-timeout>
+
+static void set_flag(bool * flag)
+{
+	*flag = true;
+}
+
+/* the reactor may go back to waiting for io after running the
+expiring timer, so poll instead of blocking in dispatch */
+static void wait_expired(tscb::posix_reactor & reactor, const bool & expired)
+{
+	while (!expired) {
+		reactor.dispatch_pending_all();
+		usleep(1000);
+	}
+}
+
+static void read_byte(int fd, tscb::ioready_events)
+{
+	char c;
+	assert(read(fd, &c, 1) == 1);
+}
+
+void test_touch_defers_expiry(void)
+{
+	tscb::posix_reactor reactor;
+	bool expired = false;
+	tscb::idle_timeout idle(reactor, std::chrono::milliseconds(30), std::bind(set_flag, &expired));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() < start + std::chrono::milliseconds(100)) {
+		idle.touch();
+		reactor.dispatch_pending_all();
+		assert(!expired);
+		usleep(5000);
+	}
+
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+	idle.touch(last);
+	wait_expired(reactor, expired);
+	assert(std::chrono::steady_clock::now() >= last + std::chrono::milliseconds(30));
+
+	/* fires only once, until restarted */
+	expired = false;
+	idle.restart();
+	wait_expired(reactor, expired);
+}
+
+void test_watch_touches(void)
+{
+	tscb::posix_reactor reactor;
+	bool expired = false;
+	tscb::idle_timeout idle(reactor, std::chrono::milliseconds(30), std::bind(set_flag, &expired));
+
+	int fds[2];
+	assert(pipe(fds) == 0);
+	tscb::ioready_connection c = idle.watch(reactor,
+		std::bind(read_byte, fds[0], std::placeholders::_1), fds[0], tscb::ioready_input);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() < start + std::chrono::milliseconds(100)) {
+		assert(write(fds[1], "x", 1) == 1);
+		reactor.dispatch_pending_all();
+		assert(!expired);
+		usleep(5000);
+	}
+
+	wait_expired(reactor, expired);
+
+	c.disconnect();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	test_touch_defers_expiry();
+	test_watch_touches();
+}
@@ -251,6 +251,49 @@ void test_dispatcher_sync_disconnect(ioready_dispatcher * d)
 	close(sw.pipe2[1]);
 }
 
+void test_dispatcher_compact(ioready_dispatcher * d, std::function<size_t(void)> fd_limit)
+{
+	std::chrono::steady_clock::duration t = std::chrono::milliseconds(0);
+
+	int pipefd[2];
+	assert(pipe(pipefd) != -1);
+
+	/* grow the table with a high descriptor, then drop it again */
+	int high = dup2(pipefd[0], 500);
+	ASSERT(high == 500);
+	int called = 0;
+	tscb::ioready_connection link = d->watch(std::bind(function, &called, high, std::placeholders::_1),
+		high, ioready_input);
+	ASSERT(fd_limit() > 500);
+	link.disconnect();
+	d->compact();
+	ASSERT(fd_limit() < 500);
+
+	/* reusing the descriptor after compaction works */
+	link = d->watch(std::bind(function, &called, high, std::placeholders::_1),
+		high, ioready_input);
+	assert(write(pipefd[1], &called, 1) != -1);
+	d->dispatch(&t);
+	ASSERT(called == 1);
+	ASSERT(fd_limit() > 500);
+	link.disconnect();
+	d->compact();
+	ASSERT(fd_limit() < 500);
+
+	/* as do low descriptors */
+	called = 0;
+	link = d->watch(std::bind(function, &called, pipefd[0], std::placeholders::_1),
+		pipefd[0], ioready_input);
+	assert(write(pipefd[1], &called, 1) != -1);
+	d->dispatch(&t);
+	ASSERT(called == 1);
+	link.disconnect();
+
+	close(high);
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
 static int cancel_dispatching = 0;
 
 static void *run_dispatcher(void *arg)
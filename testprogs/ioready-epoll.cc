@@ -8,20 +8,153 @@
 
 #include "tests.h"
 
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
 #include "ioready-dispatcher"
 #include <tscb/ioready-epoll>
 
 using namespace tscb;
 
+class inspectable_dispatcher_epoll : public ioready_dispatcher_epoll {
+public:
+	size_t fd_limit(void) { return fdtab_.fd_limit(); }
+};
+
+void test_shrink(void)
+{
+	inspectable_dispatcher_epoll dispatcher;
+
+	int pipefd[2];
+	assert(pipe(pipefd) != -1);
+	int high = dup2(pipefd[0], 500);
+	ASSERT(high == 500);
+
+	ioready_connection link = dispatcher.watch([](ioready_events) {}, high, ioready_input);
+	ASSERT(dispatcher.fd_limit() > 500);
+	link.disconnect();
+
+	dispatcher.compact();
+	ASSERT(dispatcher.fd_limit() < 500);
+
+	close(high);
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+static bool rejected(std::function<void(void)> function)
+{
+	try {
+		function();
+	}
+	catch (std::invalid_argument &) {
+		return true;
+	}
+	return false;
+}
+
+void test_exclusive(void)
+{
+	ioready_dispatcher_epoll first, second;
+
+	int pipefd[2];
+	assert(pipe(pipefd) != -1);
+
+	int first_count = 0, second_count = 0;
+	ioready_connection link1 = first.watch([&first_count](ioready_events) {++first_count;},
+		pipefd[0], ioready_input | ioready_exclusive);
+	ioready_connection link2 = second.watch([&second_count](ioready_events) {++second_count;},
+		pipefd[0], ioready_input | ioready_exclusive);
+
+	char c = 0;
+	assert(write(pipefd[1], &c, 1) == 1);
+	first.dispatch_pending(16);
+	second.dispatch_pending(16);
+	ASSERT(first_count == 1);
+	ASSERT(second_count == 1);
+
+	/* exclusive and other callbacks cannot share a descriptor */
+	ASSERT(rejected([&]() {first.watch([](ioready_events) {}, pipefd[0], ioready_input);}));
+	ASSERT(rejected([&]() {first.watch([](ioready_events) {}, pipefd[0], ioready_input | ioready_exclusive);}));
+
+	/* exclusive callbacks stay exclusive on modify */
+	link1.modify(ioready_none);
+	first_count = 0;
+	first.dispatch_pending(16);
+	ASSERT(first_count == 0);
+	link1.modify(ioready_input);
+	first.dispatch_pending(16);
+	ASSERT(first_count == 1);
+	ASSERT(link1.get()->event_mask() & ioready_exclusive);
+
+	link1.disconnect();
+	link2.disconnect();
+
+	/* flag cannot be added after registration */
+	ioready_connection link3 = first.watch([](ioready_events) {}, pipefd[0], ioready_input);
+	ASSERT(rejected([&]() {link3.modify(ioready_input | ioready_exclusive);}));
+	link3.disconnect();
+
+	/* descriptor usable without the flag again */
+	ioready_connection link4 = second.watch([](ioready_events) {}, pipefd[0], ioready_input);
+	link4.disconnect();
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+void test_exclusive_wakeup(void)
+{
+	ioready_dispatcher_epoll first, second;
+
+	int fd = eventfd(0, EFD_NONBLOCK);
+	assert(fd != -1);
+
+	/* callbacks leave the descriptor readable, so only the exclusive
+	wakeup keeps the second thread asleep */
+	std::atomic<int> woken(0);
+	ioready_connection link1 = first.watch([&woken](ioready_events) {++woken;},
+		fd, ioready_input | ioready_exclusive);
+	ioready_connection link2 = second.watch([&woken](ioready_events) {++woken;},
+		fd, ioready_input | ioready_exclusive);
+
+	std::chrono::steady_clock::duration timeout = std::chrono::milliseconds(500);
+	std::thread thread1([&first, &timeout]() {first.dispatch(&timeout, 16);});
+	std::thread thread2([&second, &timeout]() {second.dispatch(&timeout, 16);});
+	/* let both threads block in epoll_wait */
+	usleep(100000);
+
+	uint64_t value = 1;
+	ASSERT(write(fd, &value, sizeof(value)) == sizeof(value));
+	thread1.join();
+	thread2.join();
+	ASSERT(woken.load() == 1);
+
+	link1.disconnect();
+	link2.disconnect();
+	close(fd);
+}
+
 int main()
 {
-	ioready_dispatcher_epoll *dispatcher;
+	inspectable_dispatcher_epoll *dispatcher;
 
-	dispatcher=new ioready_dispatcher_epoll();
+	dispatcher=new inspectable_dispatcher_epoll();
 
 	test_dispatcher(dispatcher);
 	test_dispatcher_threading(dispatcher);
 	test_dispatcher_sync_disconnect(dispatcher);
+	test_dispatcher_compact(dispatcher, [dispatcher]() {return dispatcher->fd_limit();});
 
 	delete dispatcher;
+
+	test_shrink();
+	test_exclusive();
+	test_exclusive_wakeup();
 }
@@ -0,0 +1,101 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include <stdexcept>
+
+#include <tscb/pinned-reactor>
+
+static void where(int * cpu, tscb::eventflag * done)
+{
+	*cpu = sched_getcpu();
+	done->set();
+}
+
+/* some CPU we are allowed to run on */
+static int allowed_cpu(void)
+{
+	cpu_set_t set;
+	assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set)) {
+			return cpu;
+		}
+	}
+	abort();
+}
+
+static bool timer_where(int * cpu, tscb::eventflag * done, std::chrono::steady_clock::time_point &)
+{
+	*cpu = sched_getcpu();
+	done->set();
+	return false;
+}
+
+void test_placement(void)
+{
+	int allowed = allowed_cpu();
+	tscb::pinned_reactor_thread thread(allowed);
+	assert(thread.placement().cpu == allowed);
+
+	int cpu = -1;
+	tscb::pipe_eventflag done;
+	thread.reactor().post(std::bind(where, &cpu, &done));
+	done.wait();
+	assert(cpu == allowed);
+}
+
+void test_timer(void)
+{
+	int allowed = allowed_cpu();
+	tscb::pinned_reactor_thread thread(allowed);
+
+	/* registered from this thread, allocated by the reactor thread */
+	int cpu = -1;
+	tscb::pipe_eventflag done;
+	tscb::timer_connection c = thread.timer(
+		std::bind(timer_where, &cpu, &done, std::placeholders::_1),
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+	done.wait();
+	assert(cpu == allowed);
+	c.disconnect();
+
+	/* from the reactor thread itself */
+	tscb::pipe_eventflag registered;
+	tscb::timer_connection inner;
+	thread.reactor().post([&thread, &inner, &registered]() {
+		inner = thread.timer([](std::chrono::steady_clock::time_point &) { return false; },
+			std::chrono::steady_clock::now() + std::chrono::hours(1));
+		registered.set();
+	});
+	registered.wait();
+	assert(inner.connected());
+	inner.disconnect();
+}
+
+void test_invalid_cpu(void)
+{
+	bool caught = false;
+	try {
+		tscb::pinned_reactor_thread thread(CPU_SETSIZE - 1);
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+}
+
+int main()
+{
+	test_placement();
+	test_timer();
+	test_invalid_cpu();
+}
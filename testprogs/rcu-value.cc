@@ -0,0 +1,103 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tscb/rcu-value>
+
+class tracked {
+public:
+	tracked(int value) : value_(value) {++alive;}
+	tracked(const tracked & other) : value_(other.value_) {++alive;}
+	~tracked(void) {--alive;}
+
+	int value_;
+
+	static std::atomic<int> alive;
+};
+
+std::atomic<int> tracked::alive(0);
+
+void test_basic(void)
+{
+	tscb::rcu_value<std::string> v("first");
+	assert(*v.read() == "first");
+	v.update("second");
+	assert(*v.read() == "second");
+	assert(v.read()->size() == 6);
+}
+
+void test_snapshot_outlives_update(void)
+{
+	{
+		tscb::rcu_value<tracked> v(1);
+		assert(tracked::alive == 1);
+		{
+			tscb::rcu_value<tracked>::snapshot s = v.read();
+			v.update(tracked(2));
+			v.update(tracked(3));
+			/* replaced versions kept alive by the snapshot */
+			assert(s->value_ == 1);
+			assert(tracked::alive == 3);
+			assert(v.read()->value_ == 3);
+		}
+		/* reclaimed once the last snapshot is gone */
+		v.read();
+		assert(tracked::alive == 1);
+
+		/* without readers, replaced versions go away immediately */
+		v.update(tracked(4));
+		assert(tracked::alive == 1);
+	}
+	assert(tracked::alive == 0);
+}
+
+void test_concurrent(void)
+{
+	struct pair {
+		pair(int a, int b) : a_(a), b_(b) {}
+		int a_, b_;
+	};
+	tscb::rcu_value<pair> v(0, 0);
+	std::atomic<bool> stop(false);
+
+	std::vector<std::thread> readers;
+	for (int n = 0; n < 4; ++n) {
+		readers.push_back(std::thread([&v, &stop]() {
+			int last = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				tscb::rcu_value<pair>::snapshot s = v.read();
+				assert(s->a_ == s->b_);
+				assert(s->a_ >= last);
+				last = s->a_;
+			}
+		}));
+	}
+
+	for (int n = 1; n <= 20000; ++n) {
+		v.update(pair(n, n));
+	}
+	stop.store(true);
+	for (std::thread & t : readers) {
+		t.join();
+	}
+	assert(v.read()->a_ == 20000);
+}
+
+int main(void)
+{
+	test_basic();
+	test_snapshot_outlives_update();
+	test_concurrent();
+	return 0;
+}
@@ -6,13 +6,20 @@
  * Refer to the file "COPYING" for details.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <assert.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <tscb/dispatch>
+#include <tscb/worker-pool>
 
 static bool dummy_timer(int * what, std::chrono::steady_clock::time_point &)
 {
@@ -205,10 +212,381 @@ void test_post_during_dispatch(void)
 	reactor.dispatch_pending_all();
 }
 
+void test_offload(void)
+{
+	tscb::posix_reactor reactor;
+	/* single worker, at most one queued item */
+	tscb::worker_pool pool(1, 1);
+	tscb::pipe_eventflag started, gate;
+	std::thread::id reactor_thread = std::this_thread::get_id();
+	int completed = 0;
+
+	auto completion = [&completed, reactor_thread]()
+	{
+		assert(std::this_thread::get_id() == reactor_thread);
+		completed ++;
+	};
+
+	assert(reactor.offload(pool, [&started, &gate]() {started.set(); gate.wait();}, completion));
+	started.wait();
+
+	/* worker is busy, one more item may be queued */
+	assert(reactor.offload(pool, []() {}, completion));
+	assert(!reactor.offload(pool, []() {}, completion));
+
+	gate.set();
+	while (completed < 2) {
+		reactor.dispatch_pending_all();
+		usleep(1000);
+	}
+	reactor.dispatch_pending_all();
+	assert(completed == 2);
+
+	/* process-wide pool */
+	bool done = false;
+	assert(reactor.offload([]() {}, [&done]() {done = true;}));
+	while (!done) {
+		reactor.dispatch_pending_all();
+		usleep(1000);
+	}
+}
+
+void test_after_fork(void)
+{
+	tscb::posix_reactor reactor;
+
+	int fds[2];
+	int reader_called = 0;
+	assert(pipe(fds) != -1);
+	tscb::connection c = reactor.watch(std::bind(dummy_reader, &reader_called, fds[0], std::placeholders::_1), fds[0], tscb::ioready_input);
+	reactor.dispatch_pending_all();
+
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		reactor.after_fork_child();
+
+		/* watches survive */
+		char tmp = 'x';
+		if (write(fds[1], &tmp, 1) != 1) {
+			_exit(1);
+		}
+		while (!reader_called) {
+			reactor.dispatch();
+		}
+
+		/* wakeup from another thread */
+		int worker_called = 0;
+		std::thread thread([&reactor, &worker_called]() {
+			usleep(10000);
+			reactor.post(std::bind(dummy_work, &worker_called));
+		});
+		while (!worker_called) {
+			reactor.dispatch();
+		}
+		thread.join();
+
+		/* must not affect the parent's registration */
+		c.disconnect();
+		reactor.dispatch_pending_all();
+		_exit(0);
+	}
+
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	assert(write(fds[1], "x", 1) == 1);
+	while (!reader_called) {
+		reactor.dispatch();
+	}
+
+	c.disconnect();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* one iteration of a foreign event loop embedding the reactor */
+static void embedded_iteration(tscb::posix_reactor & reactor)
+{
+	std::chrono::steady_clock::duration timeout = reactor.prepare();
+	int poll_timeout = -1;
+	if (timeout != std::chrono::steady_clock::duration::max()) {
+		poll_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+			timeout + std::chrono::milliseconds(1) - std::chrono::steady_clock::duration(1)).count();
+	}
+	struct pollfd pfd;
+	pfd.fd = reactor.pollable_fd();
+	pfd.events = POLLIN;
+	poll(&pfd, 1, poll_timeout);
+	reactor.check();
+	reactor.dispatch_pending_all();
+}
+
+void test_embedded(void)
+{
+	tscb::posix_reactor reactor;
+	reactor.dispatch_pending_all();
+
+	/* nothing to do: wait indefinitely */
+	assert(reactor.prepare() == std::chrono::steady_clock::duration::max());
+	reactor.check();
+
+	/* timers */
+	{
+		int timer_called = 0;
+		std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+		tscb::connection c = reactor.timer(std::bind(dummy_timer, &timer_called, std::placeholders::_1), due);
+		reactor.dispatch_pending_all();
+
+		std::chrono::steady_clock::duration timeout = reactor.prepare();
+		assert(timeout > std::chrono::steady_clock::duration::zero());
+		assert(timeout <= std::chrono::milliseconds(10));
+		reactor.check();
+
+		while (!timer_called) {
+			embedded_iteration(reactor);
+		}
+		assert(std::chrono::steady_clock::now() >= due);
+	}
+
+	/* io */
+	{
+		int fds[2];
+		int reader_called = 0;
+		assert(pipe(fds) != -1);
+		tscb::connection c = reactor.watch(std::bind(dummy_reader, &reader_called, fds[0], std::placeholders::_1), fds[0], tscb::ioready_input);
+		assert(write(fds[1], "x", 1) == 1);
+		while (!reader_called) {
+			embedded_iteration(reactor);
+		}
+		c.disconnect();
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	/* work posted from another thread while blocked in poll */
+	{
+		int worker_called = 0;
+		std::thread thread([&reactor, &worker_called]() {
+			usleep(10000);
+			reactor.post(std::bind(dummy_work, &worker_called));
+		});
+		while (!worker_called) {
+			embedded_iteration(reactor);
+		}
+		thread.join();
+	}
+}
+
+void test_bounded_workqueue(void)
+{
+	tscb::posix_reactor reactor;
+	reactor.set_workqueue_capacity(2);
+
+	int worker_called = 0;
+	assert(reactor.try_post(std::bind(dummy_work, &worker_called)));
+	assert(reactor.try_post(std::bind(dummy_work, &worker_called)));
+	assert(!reactor.try_post(std::bind(dummy_work, &worker_called)));
+	assert(reactor.workqueue_depth() == 2);
+
+	/* unbounded post is not affected */
+	reactor.post(std::bind(dummy_work, &worker_called));
+	assert(reactor.workqueue_depth() == 3);
+
+	std::atomic<bool> posted(false);
+	std::thread thread([&reactor, &worker_called, &posted]() {
+		reactor.post_when_space(std::bind(dummy_work, &worker_called));
+		posted.store(true);
+	});
+
+	usleep(10000);
+	assert(!posted.load());
+
+	/* draining makes room and releases the blocked producer */
+	while (!posted.load()) {
+		reactor.dispatch_pending();
+		usleep(1000);
+	}
+	thread.join();
+	reactor.dispatch_pending_all();
+	assert(worker_called == 4);
+	assert(reactor.workqueue_depth() == 0);
+}
+
+void test_dispatch_after_consumed_wakeup(void)
+{
+	tscb::posix_reactor reactor;
+
+	int worker_called = 0;
+	reactor.post(std::bind(dummy_work, &worker_called));
+	reactor.post(std::bind(dummy_work, &worker_called));
+	/* runs one item, and its io poll consumes the wakeup that was
+	raised for the remaining one */
+	reactor.dispatch_pending();
+	assert(worker_called == 1);
+
+	/* must run the remaining item and return without blocking */
+	std::atomic<bool> returned(false), stuck(false);
+	std::thread watchdog([&reactor, &returned, &stuck]() {
+		for (int n = 0; n < 2000 && !returned.load(); ++n) {
+			usleep(1000);
+		}
+		if (!returned.load()) {
+			stuck.store(true);
+			reactor.get_eventtrigger().set();
+		}
+	});
+	reactor.dispatch();
+	returned.store(true);
+	watchdog.join();
+
+	assert(worker_called == 2);
+	assert(!stuck.load());
+}
+
+void test_reserved_workitems(void)
+{
+	tscb::posix_reactor reactor;
+	reactor.reserve_workitems(2);
+	reactor.set_workqueue_capacity(2);
+
+	/* more items than reserved nodes: falls back to allocation */
+	int worker_called = 0;
+	for (int n = 0; n < 3; ++n) {
+		reactor.post(std::bind(dummy_work, &worker_called));
+	}
+	/* refused without taking a node */
+	assert(!reactor.try_post(std::bind(dummy_work, &worker_called)));
+	reactor.dispatch_pending_all();
+	assert(worker_called == 3);
+
+	/* nodes are reused */
+	for (int round = 0; round < 10; ++round) {
+		assert(reactor.try_post(std::bind(dummy_work, &worker_called)));
+		assert(reactor.try_post(std::bind(dummy_work, &worker_called)));
+		reactor.dispatch_pending_all();
+	}
+	assert(worker_called == 23);
+
+	/* bound state is destroyed after running, not when reused */
+	std::shared_ptr<int> state(new int(0));
+	reactor.post([state]() { ++*state; });
+	reactor.dispatch_pending_all();
+	assert(*state == 1);
+	assert(state.use_count() == 1);
+
+	reactor.reserve_workitems(0);
+	reactor.post(std::bind(dummy_work, &worker_called));
+	reactor.dispatch_pending_all();
+	assert(worker_called == 24);
+}
+
+void test_before_wait(void)
+{
+	tscb::posix_reactor reactor;
+	std::vector<std::string> order;
+
+	tscb::connection hook = reactor.before_wait([&order]() { order.push_back("hook"); });
+	/* keeps the io wait short */
+	tscb::timer_connection timer = reactor.timer(
+		[&order](std::chrono::steady_clock::time_point & t)
+		{
+			order.push_back("timer");
+			t += std::chrono::milliseconds(1);
+			return true;
+		},
+		std::chrono::steady_clock::now());
+
+	reactor.dispatch();
+	assert(order.size() >= 2);
+	assert(order[0] == "timer");
+	assert(order[1] == "hook");
+
+	/* output queued by io callbacks is seen by the hook of the
+	next iteration, before waiting again */
+	int pipefd[2];
+	assert(pipe(pipefd) == 0);
+	tscb::ioready_connection io = reactor.watch(
+		[&order, &pipefd](tscb::ioready_events)
+		{
+			char c;
+			assert(read(pipefd[0], &c, 1) == 1);
+			order.push_back("io");
+		},
+		pipefd[0], tscb::ioready_input);
+	assert(write(pipefd[1], "x", 1) == 1);
+	order.clear();
+	while (std::find(order.begin(), order.end(), "io") == order.end()) {
+		reactor.dispatch();
+	}
+	reactor.dispatch();
+	std::vector<std::string>::iterator i = std::find(order.begin(), order.end(), "io");
+	assert(std::find(i, order.end(), "hook") != order.end());
+
+	/* hook of the free dispatch function, run after the timers */
+	{
+		std::unique_ptr<tscb::ioready_dispatcher> io(tscb::ioready_dispatcher::create());
+		tscb::timerqueue_dispatcher timers(io->get_eventtrigger());
+		std::vector<std::string> plain;
+		tscb::timer_connection t = timers.timer(
+			[&plain](std::chrono::steady_clock::time_point &) { plain.push_back("timer"); return false; },
+			std::chrono::steady_clock::now());
+		io->get_eventtrigger().set();
+		tscb::dispatch(&timers, io.get(), [&plain]() { plain.push_back("hook"); });
+		assert(plain.size() == 2 && plain[0] == "timer" && plain[1] == "hook");
+	}
+
+	/* embedded loops run the hooks in prepare */
+	order.clear();
+	reactor.prepare();
+	reactor.check();
+	assert(order.size() == 1 && order[0] == "hook");
+
+	/* exceptions from hooks are propagated before waiting */
+	tscb::connection failing = reactor.before_wait([]() { throw std::runtime_error("hook"); });
+	bool caught = false;
+	try {
+		reactor.prepare();
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+	caught = false;
+	try {
+		reactor.dispatch();
+	}
+	catch (std::runtime_error const&) {
+		caught = true;
+	}
+	assert(caught);
+	failing.disconnect();
+	reactor.prepare();
+	reactor.check();
+
+	hook.disconnect();
+	order.clear();
+	reactor.dispatch();
+	assert(std::find(order.begin(), order.end(), "hook") == order.end());
+
+	io.disconnect();
+	timer.disconnect();
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
 int main()
 {
 	test_basic_operation();
 	test_workqueue_monopolization();
 	test_pending();
 	test_post_during_dispatch();
+	test_offload();
+	test_after_fork();
+	test_embedded();
+	test_bounded_workqueue();
+	test_dispatch_after_consumed_wakeup();
+	test_reserved_workitems();
+	test_before_wait();
 }
@@ -0,0 +1,165 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tscb/dispatch>
+#include <tscb/shm-channel>
+
+static void collect(std::vector<std::string> * messages, const void * data, size_t size)
+{
+	messages->push_back(std::string(reinterpret_cast<const char *>(data), size));
+}
+
+void test_doorbell(void)
+{
+	tscb::shm_channel producer(4096);
+	tscb::shm_channel consumer(dup(producer.memory_fd()), dup(producer.doorbell_fd()));
+
+	assert(producer.send("a", 1));
+	assert(producer.send("bc", 2));
+	assert(producer.send("def", 3));
+
+	/* only the first message rang the doorbell */
+	uint64_t value = 0;
+	assert(read(producer.doorbell_fd(), &value, sizeof(value)) == sizeof(value));
+	assert(value == 1);
+
+	tscb::posix_reactor reactor;
+	std::vector<std::string> messages;
+	tscb::connection c = consumer.receive(reactor,
+		std::bind(collect, &messages, std::placeholders::_1, std::placeholders::_2));
+	reactor.dispatch_pending_all();
+
+	assert(messages.size() == 3);
+	assert(messages[0] == "a");
+	assert(messages[1] == "bc");
+	assert(messages[2] == "def");
+
+	/* ring is empty again, next message rings the doorbell */
+	assert(producer.send("g", 1));
+	reactor.dispatch_pending_all();
+	assert(messages.size() == 4);
+	assert(messages[3] == "g");
+
+	c.disconnect();
+}
+
+void test_full_and_wrap(void)
+{
+	tscb::shm_channel producer(256);
+	tscb::shm_channel consumer(dup(producer.memory_fd()), dup(producer.doorbell_fd()));
+
+	bool caught = false;
+	try {
+		std::string huge(producer.max_message_size() + 1, 'x');
+		producer.send(huge.data(), huge.size());
+	}
+	catch (std::invalid_argument const&) {
+		caught = true;
+	}
+	assert(caught);
+
+	tscb::posix_reactor reactor;
+	std::vector<std::string> messages;
+	tscb::connection c = consumer.receive(reactor,
+		std::bind(collect, &messages, std::placeholders::_1, std::placeholders::_2));
+	reactor.dispatch_pending_all();
+
+	/* fill ring until it refuses, drain, repeat: exercises wrap-around
+	with varying message sizes */
+	size_t sent = 0;
+	for (int round = 0; round < 20; ++round) {
+		for (;;) {
+			std::string msg(1 + (sent * 7) % 40, 'a' + sent % 26);
+			if (!producer.send(msg.data(), msg.size())) {
+				break;
+			}
+			++sent;
+		}
+		reactor.dispatch_pending_all();
+		assert(messages.size() == sent);
+	}
+
+	for (size_t n = 0; n < sent; ++n) {
+		assert(messages[n] == std::string(1 + (n * 7) % 40, 'a' + n % 26));
+	}
+
+	c.disconnect();
+}
+
+/* overwrite part of the shared memory as a misbehaving peer would */
+static void corrupt(int memory_fd, size_t offset, const void * data, size_t size)
+{
+	void * addr = mmap(nullptr, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+	assert(addr != MAP_FAILED);
+	memcpy(reinterpret_cast<char *>(addr) + offset, data, size);
+	munmap(addr, offset + size);
+}
+
+void test_corrupt_peer(void)
+{
+	/* control block: head at 0, tail at 64; ring starts at 128 */
+	const size_t ring = 128;
+
+	/* record length beyond the ring */
+	{
+		tscb::shm_channel producer(256);
+		tscb::shm_channel consumer(dup(producer.memory_fd()), dup(producer.doorbell_fd()));
+		assert(producer.send("hello", 5));
+		uint32_t length = 1000000;
+		corrupt(producer.memory_fd(), ring, &length, sizeof(length));
+
+		tscb::posix_reactor reactor;
+		std::vector<std::string> messages;
+		tscb::connection c = consumer.receive(reactor,
+			std::bind(collect, &messages, std::placeholders::_1, std::placeholders::_2));
+		reactor.dispatch_pending_all();
+		assert(messages.empty());
+		assert(consumer.failed());
+
+		/* stays failed */
+		assert(producer.send("world", 5));
+		reactor.dispatch_pending_all();
+		assert(messages.empty());
+		c.disconnect();
+	}
+
+	/* head too far ahead of tail */
+	{
+		tscb::shm_channel producer(256);
+		tscb::shm_channel consumer(dup(producer.memory_fd()), dup(producer.doorbell_fd()));
+		assert(producer.send("hello", 5));
+		uint64_t head = 4096;
+		corrupt(producer.memory_fd(), 0, &head, sizeof(head));
+
+		tscb::posix_reactor reactor;
+		std::vector<std::string> messages;
+		tscb::connection c = consumer.receive(reactor,
+			std::bind(collect, &messages, std::placeholders::_1, std::placeholders::_2));
+		reactor.dispatch_pending_all();
+		assert(messages.empty());
+		assert(consumer.failed());
+		c.disconnect();
+	}
+}
+
+int main()
+{
+	test_doorbell();
+	test_full_and_wrap();
+	test_corrupt_peer();
+}
@@ -7,7 +7,12 @@
  */
 
 #define _LIBTSCB_CALLBACK_UNITTESTS 1
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
 #include <tscb/signal>
+#include <tscb/worker-pool>
 #include "tests.h"
 
 int result = 0;
@@ -169,8 +174,79 @@ void callback_tests(void)
 	}
 }
 
+void parallel_tests(void)
+{
+	tscb::worker_pool pool(4);
+
+	/* all callbacks called once */
+	{
+		tscb::signal<void (int)> chain;
+		std::atomic<int> sum(0), count(0);
+		std::vector<tscb::connection> links;
+		for (int n = 0; n < 64; ++n) {
+			links.push_back(chain.connect([&sum, &count](int arg) {
+				sum += arg;
+				++count;
+			}));
+		}
+
+		chain.emit_parallel(pool, 3).get();
+		ASSERT(count == 64);
+		ASSERT(sum == 64 * 3);
+
+		for (tscb::connection & link : links) {
+			link.disconnect();
+		}
+	}
+	/* no callbacks */
+	{
+		tscb::signal<void (int)> chain;
+		std::future<void> done = chain.emit_parallel(pool, 1);
+		ASSERT(done.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+		done.get();
+	}
+	/* exception propagated, other callbacks still called */
+	{
+		tscb::signal<void (int)> chain;
+		std::atomic<int> count(0);
+		tscb::connection link1 = chain.connect([](int) { throw std::runtime_error("fail"); });
+		tscb::connection link2 = chain.connect([&count](int) { ++count; });
+
+		bool caught = false;
+		try {
+			chain.emit_parallel(pool, 1).get();
+		}
+		catch (std::runtime_error &) {
+			caught = true;
+		}
+		ASSERT(caught);
+		ASSERT(count == 1);
+
+		link1.disconnect();
+		link2.disconnect();
+	}
+	/* disconnect during emission is deferred */
+	{
+		called = 0;
+		Receiver r;
+		tscb::signal<void (int)> chain;
+		r.link1 = chain.connect(std::bind(&Receiver::cbrecv3, &r, std::placeholders::_1));
+		r.link2 = chain.connect([](int) {});
+
+		chain.emit_parallel(pool, 5).get();
+		ASSERT(called == 1);
+		ASSERT(!r.link1.connected());
+		ASSERT(!r.link2.connected());
+
+		called = 0;
+		chain.emit_parallel(pool, 6).get();
+		ASSERT(called == 0);
+	}
+}
+
 int main(void)
 {
 	callback_tests();
+	parallel_tests();
 	return 0;
 }
@@ -7,6 +7,9 @@
  */
 
 #define _LIBTSCB_CALLBACK_UNITTESTS 1
+#include <set>
+#include <vector>
+
 #include <tscb/timer>
 #include <tscb/eventflag>
 #include "tests.h"
@@ -156,8 +159,108 @@ void timer_tests(void)
 	}
 }
 
+void periodic_timer_tests(void)
+{
+	generic_timerqueue_dispatcher<long long> tq(flag);
+
+	/* on time: one call per tick, no drift */
+	{
+		std::vector<long long> calls;
+		tscb::abstract_timer_connection<long long> link = tq.periodic_timer(
+			[&calls](long long now, unsigned long ticks) {
+				ASSERT(ticks == 1);
+				calls.push_back(now);
+				return true;
+			}, 10, 10);
+
+		for (long long time = 0; time <= 50; time += 5) {
+			long long now = time;
+			tq.run_queue(now);
+		}
+		ASSERT(calls.size() == 5);
+		ASSERT(calls[0] == 10 && calls[4] == 50);
+		link.disconnect();
+	}
+
+	/* late by several periods */
+	{
+		unsigned long calls = 0, total = 0;
+		tscb::abstract_timer_connection<long long> link = tq.periodic_timer(
+			[&calls, &total](long long, unsigned long ticks) {
+				++calls;
+				total += ticks;
+				return true;
+			}, 10, 10, timer_catchup_skip);
+		long long now = 45;
+		tq.run_queue(now);
+		ASSERT(calls == 1 && total == 1);
+		/* stays on grid */
+		ASSERT(now == 50);
+		link.disconnect();
+	}
+	{
+		unsigned long calls = 0, total = 0;
+		tscb::abstract_timer_connection<long long> link = tq.periodic_timer(
+			[&calls, &total](long long, unsigned long ticks) {
+				++calls;
+				total += ticks;
+				return true;
+			}, 10, 10, timer_catchup_coalesce);
+		long long now = 45;
+		tq.run_queue(now);
+		ASSERT(calls == 1 && total == 4);
+		ASSERT(now == 50);
+		link.disconnect();
+	}
+	{
+		unsigned long calls = 0, total = 0;
+		tscb::abstract_timer_connection<long long> link = tq.periodic_timer(
+			[&calls, &total](long long, unsigned long ticks) {
+				++calls;
+				total += ticks;
+				return true;
+			}, 10, 10, timer_catchup_burst);
+		long long now = 45;
+		tq.run_queue(now);
+		ASSERT(calls == 4 && total == 4);
+		ASSERT(now == 50);
+		link.disconnect();
+	}
+
+	/* returning false cancels */
+	{
+		int count = 0;
+		tscb::abstract_timer_connection<long long> link = tq.periodic_timer(
+			[&count](long long, unsigned long) {
+				return ++count < 2;
+			}, 0, 1, timer_catchup_burst);
+		long long now = 10;
+		tq.run_queue(now);
+		ASSERT(count == 2);
+		ASSERT(!link.connected());
+	}
+
+	/* phase spreading */
+	{
+		std::vector<tscb::abstract_timer_connection<long long> > links;
+		std::set<long long> phases;
+		for (int n = 0; n < 64; ++n) {
+			links.push_back(tq.periodic_timer(
+				[](long long, unsigned long) { return true; }, 0, 100000, timer_catchup_skip, 100000));
+			long long due = links.back().get()->expires();
+			ASSERT(due >= 0 && due < 100000);
+			phases.insert(due);
+		}
+		ASSERT(phases.size() == 64);
+		for (tscb::abstract_timer_connection<long long> & link : links) {
+			link.disconnect();
+		}
+	}
+}
+
 int main()
 {
 	timer_tests();
+	periodic_timer_tests();
 	return 0;
 }
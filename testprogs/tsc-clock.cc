@@ -0,0 +1,95 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <memory>
+
+#include <tscb/tsc-clock>
+
+static bool count_timer(int * count, tscb::tsc_clock::time_point & now)
+{
+	(*count) ++;
+	/* keep re-arming, so that dispatch does not go on to wait for
+	io without timeout after the expiry */
+	now += std::chrono::milliseconds(1);
+	return true;
+}
+
+void test_calibrate(void)
+{
+	/* not calibrated implicitly: falls back to the monotonic clock */
+	tscb::tsc_clock::now();
+	assert(!tscb::tsc_clock::uses_tsc());
+	assert(tscb::tsc_clock::drift_bound() == 0);
+
+	tscb::tsc_clock::calibrate();
+	if (tscb::tsc_clock::uses_tsc()) {
+		assert(tscb::tsc_clock::drift_bound() > 0);
+		assert(tscb::tsc_clock::drift_bound() < 1000);
+	}
+
+	/* idempotent */
+	double bound = tscb::tsc_clock::drift_bound();
+	tscb::tsc_clock::calibrate();
+	assert(tscb::tsc_clock::drift_bound() == bound);
+}
+
+void test_clock(void)
+{
+	tscb::tsc_clock::time_point last = tscb::tsc_clock::now();
+	for (int n = 0; n < 100000; ++n) {
+		tscb::tsc_clock::time_point now = tscb::tsc_clock::now();
+		assert(now >= last);
+		last = now;
+	}
+
+	/* shares epoch with steady clock */
+	std::chrono::steady_clock::time_point steady = std::chrono::steady_clock::now();
+	tscb::tsc_clock::time_point tsc = tscb::tsc_clock::now();
+	std::chrono::steady_clock::duration diff = tscb::tsc_clock::to_steady(tsc) - steady;
+	assert(std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() < 5);
+	assert(std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() > -5);
+
+	assert(tscb::tsc_clock::from_steady(tscb::tsc_clock::to_steady(tsc)) == tsc);
+}
+
+void test_dispatch(void)
+{
+	std::unique_ptr<tscb::ioready_dispatcher> io(tscb::ioready_dispatcher::create());
+	tscb::tsc_timerqueue_dispatcher timers(io->get_eventtrigger());
+
+	int count = 0;
+	tscb::tsc_clock::time_point start = tscb::tsc_clock::now();
+	tscb::tsc_timer_connection c = timers.timer(std::bind(count_timer, &count, std::placeholders::_1),
+		start + std::chrono::milliseconds(10));
+
+	while (!count) {
+		tscb::dispatch(&timers, io.get());
+	}
+	assert(tscb::tsc_clock::now() >= start + std::chrono::milliseconds(10));
+	while (count < 3) {
+		tscb::dispatch(&timers, io.get());
+	}
+
+	/* hook runs before each wait */
+	int hook_called = 0;
+	while (count < 4) {
+		tscb::dispatch(&timers, io.get(), [&hook_called]() { ++hook_called; });
+	}
+	assert(hook_called > 0);
+	c.disconnect();
+}
+
+int main()
+{
+	test_calibrate();
+	test_clock();
+	test_dispatch();
+}
@@ -0,0 +1,199 @@
+/* -*- C++ -*-
+ * (c) 2011 Helge Bahmann <hcb@chaoticmind.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * Refer to the file "COPYING" for details.
+ */
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <tscb/virtual-clock-reactor>
+
+void test_time_compression(void)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tscb::virtual_clock_reactor reactor(start);
+	assert(reactor.now() == start);
+
+	/* 1000 "connections" with a keepalive every 30 seconds for an hour */
+	const int count = 1000;
+	std::vector<int> fired(count, 0);
+	std::vector<tscb::timer_connection> timers;
+	for (int n = 0; n < count; ++n) {
+		int * f = &fired[n];
+		timers.push_back(reactor.timer(
+			[f](std::chrono::steady_clock::time_point & t)
+			{
+				(*f)++;
+				t += std::chrono::seconds(30);
+				return true;
+			},
+			start + std::chrono::milliseconds(30 * n)));
+	}
+
+	std::chrono::steady_clock::time_point last = reactor.now();
+	while (reactor.now() < start + std::chrono::hours(1)) {
+		reactor.dispatch();
+		/* time never runs backwards */
+		assert(reactor.now() >= last);
+		last = reactor.now();
+	}
+	for (int n = 0; n < count; ++n) {
+		assert(fired[n] >= 120);
+		timers[n].disconnect();
+	}
+
+	/* far less real time passed than virtual time */
+	assert(std::chrono::steady_clock::now() - start < std::chrono::minutes(1));
+}
+
+void test_io_before_jump(void)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tscb::virtual_clock_reactor reactor(start);
+
+	int timer_fired = 0;
+	tscb::timer_connection timer = reactor.timer(
+		[&timer_fired](std::chrono::steady_clock::time_point &)
+		{
+			timer_fired++;
+			return false;
+		},
+		start + std::chrono::hours(1));
+
+	int pipefd[2];
+	assert(pipe(pipefd) == 0);
+	int io_fired = 0;
+	tscb::ioready_connection io = reactor.watch(
+		[&io_fired, &pipefd](tscb::ioready_events)
+		{
+			char c;
+			assert(read(pipefd[0], &c, 1) == 1);
+			io_fired++;
+		},
+		pipefd[0], tscb::ioready_input);
+
+	/* ready io is processed without moving the clock */
+	assert(write(pipefd[1], "x", 1) == 1);
+	reactor.dispatch();
+	assert(io_fired == 1);
+	assert(timer_fired == 0);
+	assert(reactor.now() == start);
+
+	/* work items as well */
+	int work_done = 0;
+	reactor.post([&work_done]() { work_done++; });
+	reactor.dispatch();
+	assert(work_done == 1);
+	assert(reactor.now() == start);
+
+	/* idle: jump to the deadline */
+	reactor.dispatch();
+	assert(timer_fired == 1);
+	assert(reactor.now() == start + std::chrono::hours(1));
+
+	/* explicit advancing */
+	timer = reactor.timer(
+		[&timer_fired](std::chrono::steady_clock::time_point &)
+		{
+			timer_fired++;
+			return false;
+		},
+		reactor.now() + std::chrono::seconds(10));
+	reactor.advance(std::chrono::seconds(5));
+	assert(timer_fired == 1);
+	reactor.advance(std::chrono::seconds(5));
+	assert(timer_fired == 2);
+
+	io.disconnect();
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+void test_base_reference(void)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tscb::virtual_clock_reactor reactor(start);
+	/* as seen by generic loops */
+	tscb::posix_reactor & base = reactor;
+
+	int timer_fired = 0;
+	tscb::timer_connection timer = reactor.timer(
+		[&timer_fired](std::chrono::steady_clock::time_point &)
+		{
+			timer_fired++;
+			return false;
+		},
+		start + std::chrono::hours(1));
+
+	/* not due in virtual time */
+	base.dispatch_pending_all();
+	assert(timer_fired == 0);
+	std::chrono::steady_clock::duration timeout = base.prepare();
+	base.check();
+	assert(timeout == std::chrono::hours(1));
+
+	/* jumps instead of waiting an hour */
+	base.dispatch();
+	assert(timer_fired == 1);
+	assert(reactor.now() == start + std::chrono::hours(1));
+
+	/* due in virtual time, although not in real time */
+	timer = reactor.timer(
+		[&timer_fired](std::chrono::steady_clock::time_point &)
+		{
+			timer_fired++;
+			return false;
+		},
+		reactor.now());
+	assert(base.prepare() == std::chrono::steady_clock::duration::zero());
+	base.check();
+	base.dispatch_pending_all();
+	assert(timer_fired == 2);
+}
+
+void test_queued_work_wakeup(void)
+{
+	tscb::virtual_clock_reactor reactor(std::chrono::steady_clock::now());
+
+	int count = 0;
+	reactor.post([&count]() { count++; });
+	reactor.post([&count]() { count++; });
+
+	/* runs one item, and its io poll consumes the wakeup that was
+	raised for the remaining one */
+	assert(reactor.dispatch_pending());
+	assert(count == 1);
+
+	/* must run the remaining item and return without blocking */
+	std::atomic<bool> returned(false), stuck(false);
+	std::thread watchdog([&reactor, &returned, &stuck]() {
+		for (int n = 0; n < 2000 && !returned.load(); ++n) {
+			usleep(1000);
+		}
+		if (!returned.load()) {
+			stuck.store(true);
+			reactor.get_eventtrigger().set();
+		}
+	});
+	reactor.dispatch();
+	returned.store(true);
+	watchdog.join();
+
+	assert(count == 2);
+	assert(!stuck.load());
+}
+
+int main()
+{
+	test_time_compression();
+	test_io_before_jump();
+	test_base_reference();
+	test_queued_work_wakeup();
+}